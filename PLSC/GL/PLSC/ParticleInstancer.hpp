@@ -2,12 +2,15 @@
 
 #include "PLSC/Constants.hpp"
 #include "PLSC/Math/vec2.hpp"
-#include "PLSC/Physics/Particle.hpp"
+#include "PLSC/Physics/ParticleStorage.hpp"
+#include "PLSC/Physics/Solver.hpp"
 #include "Shader.hpp"
 #include "ShaderSources.hpp"
 
 #include <GL/glew.h>
-#include <array>
+#include <algorithm> // fill
+#include <cmath>     // NAN
+#include <vector>
 namespace PLSC::GL
 {
     class ParticleInstancer
@@ -15,18 +18,20 @@ namespace PLSC::GL
     private:
         GLuint VAO, VBO, EBO, instanceVBO;
 
-        std::array<vec2, Constants::MaxDynamicInstances> m_aData;
-        Particle *                                       m_objects;
+        std::vector<vec2>       m_vData;
+        const ParticleStorage * m_objects;
         //        std::array<Particle, Constants::MaxDynamicInstances> m_objects;
 
     public:
         Shader shader;
         u32    m_active = 0u;
 
-        ParticleInstancer(Particle * objects) : shader(vertCircle, fragCircle), m_objects(objects)
+        explicit ParticleInstancer(const ParticleStorage * objects,
+                                   const vec2 &            worldSize = Constants::WorldSize) :
+            m_vData(objects->capacity()), m_objects(objects), shader(vertCircle, fragCircle)
         {
             shader.setFloat("radius", Constants::CircleRadius);
-            shader.setVec2("worldSize", Constants::WorldWidth, Constants::WorldHeight);
+            shader.setVec2("worldSize", worldSize.x, worldSize.y);
         }
 
         void init(i32 w, i32 h)
@@ -37,7 +42,7 @@ namespace PLSC::GL
 
             glGenBuffers(1, &instanceVBO);
             glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-            glBufferData(GL_ARRAY_BUFFER, sizeof(m_aData), &m_aData[0], GL_DYNAMIC_DRAW);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(vec2) * m_vData.size(), m_vData.data(), GL_DYNAMIC_DRAW);
 
             glBindBuffer(GL_ARRAY_BUFFER, 0);
 
@@ -67,14 +72,24 @@ namespace PLSC::GL
         }
         void updatePositions(const u32 active)
         {
-            m_active = active;
-            for (u32 i = 0; i < active; ++i)
-            {
-                PLSC::Particle * p = &m_objects[i];
-                m_aData[i]         = p->P;
-            }
+            m_active = m_objects->idBound(active);
+            const f32 * const Px = m_objects->Px;
+            const f32 * const Py = m_objects->Py;
+            // Instances follow particle identities, which stay put when the storage is reordered. Ids
+            // freed by removals are NaN, which is not drawn.
+            std::fill(m_vData.begin(), m_vData.begin() + m_active, vec2(NAN, NAN));
+            for (u32 i = 0; i < active; ++i) { m_vData[m_objects->id(i)] = vec2(Px[i], Py[i]); }
+            glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vec2) * m_active, m_vData.data());
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+
+        // Same from a snapshot, which the render thread may read while the solver runs on another
+        void updatePositions(const Solver::Snapshot & snapshot)
+        {
+            m_active = static_cast<u32>(snapshot.vP.size());
             glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vec2) * active, &m_aData[0]);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vec2) * m_active, snapshot.vP.data());
             glBindBuffer(GL_ARRAY_BUFFER, 0);
         }
 
@@ -19,12 +19,12 @@ namespace PLSC::GL
         const std::vector<u32> m_indices;
 
         template <typename T>
-        explicit StaticRenderer(std::shared_ptr<T> p) :
+        explicit StaticRenderer(std::shared_ptr<T> p, const vec2 & worldSize = Constants::WorldSize) :
             m_shader(ShapeDefinition<T>::VShaderSource(), ShapeDefinition<T>::FShaderSource()),
             m_vertices(ShapeDefinition<T>::vertices(*p)),
             m_indices(ShapeDefinition<T>::indices(*p))
         {
-            m_shader.setVec2("worldSize", Constants::WorldWidth, Constants::WorldHeight);
+            m_shader.setVec2("worldSize", worldSize.x, worldSize.y);
         }
 
         void init(i32 w, i32 h)
@@ -86,12 +86,15 @@ namespace PLSC::GL
     {
     private:
         std::vector<StaticRenderer> m_vStatic;
+        const vec2                  m_worldSize;
 
     public:
+        explicit Renderer(const vec2 & worldSize = Constants::WorldSize) : m_worldSize(worldSize) { }
+
         template <typename T>
         inline void Register(std::vector<T> &v)
         {
-            for (T &t : v) { m_vStatic.emplace_back(t); }
+            for (T &t : v) { m_vStatic.emplace_back(t, m_worldSize); }
         }
 
         inline void init(i32 w, i32 h)
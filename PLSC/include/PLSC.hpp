@@ -1,5 +1,7 @@
 #pragma once
 
+#include "PLSC/IO/Trajectory.hpp"
 #include "PLSC/Math/Util.hpp"
+#include "PLSC/Physics/Ensemble.hpp"
 #include "PLSC/Physics/Solver.hpp"
 #include "PLSC/Typedefs.hpp"
\ No newline at end of file
@@ -111,12 +111,15 @@ namespace PLSC
 
         // 0.25 pre-multiply weight ratios for constant radii
         static constexpr f32 ResponseCoef       = 0.25f * static_cast<f32>(CFG::ResponseCoef);
+        // Polydisperse response is weighted by mass at runtime, so only the 0.5 pre-multiply remains
+        static constexpr f32 PolyResponseCoef   = 0.5f * static_cast<f32>(CFG::ResponseCoef);
         static constexpr f32 StaticFrictionCoef = 0.995f;
         static constexpr f32 StaticRestitution  = 0.85f; // 0.95f;
 
-        static constexpr f32 SleepLimit   = 0.005f;
-        static constexpr f32 SleepLimit2  = SleepLimit + SleepLimit;
-        static constexpr f32 SleepLimitSq = SleepLimit * SleepLimit;
+        static constexpr f32  SleepLimit   = 0.005f;
+        static constexpr f32  SleepLimit2  = SleepLimit + SleepLimit;
+        static constexpr f32  SleepLimitSq = SleepLimit * SleepLimit;
+        static constexpr u8_t SleepSteps   = 48; // Substeps spent below SleepLimit before sleeping
 
         static constexpr f32 CircleArea        = M_PI * (CircleRadius * CircleRadius);
         static constexpr f32 CircleAreaDensity = 1.0f; // TODO: Update if we add units.
@@ -1,73 +1,117 @@
 #pragma once
-#define PLSC_PROFILE 1
 
-// Static internal profiling without branches
-#ifdef PLSC_PROFILE
+// Scope profiler, enabled by building with PLSC_PROFILE=1 (CMake option PLSC_PROFILE). Every thread
+// accumulates into its own counters, so scopes may run on pool workers. With PLSC_PROFILE_TSC=1 scopes
+// read the x86 time stamp counter rather than steady_clock; ticks are converted to time on output.
+#ifndef PLSC_PROFILE
+    #define PLSC_PROFILE 0
+#endif
+#ifndef PLSC_PROFILE_TSC
+    #define PLSC_PROFILE_TSC 0
+#endif
+
+#if PLSC_PROFILE
     #include "PLSC/Typedefs.hpp"
 
     #include <chrono>
-    #include <vector>
+
+    #if PLSC_PROFILE_TSC
+        #if defined(_MSC_VER)
+            #include <intrin.h>
+        #elif defined(__x86_64__) || defined(__i386__)
+            #include <x86intrin.h>
+        #else
+            #error "PLSC_PROFILE_TSC requires an x86 target"
+        #endif
+    #endif
 
 namespace PLSC::DBG::PROFILE
 {
-    using namespace std::chrono;
+    static constexpr u32_t MaxScopes = 256; // Profiled sites per program, any further ones are ignored
 
+    inline u64_t now()
+    {
+    #if PLSC_PROFILE_TSC
+        return __rdtsc();
+    #else
+        using namespace std::chrono;
+        const nanoseconds t = duration_cast<nanoseconds>(steady_clock::now().time_since_epoch());
+        return static_cast<u64_t>(t.count());
+    #endif
+    }
+
+    // One per profiled site, registered when the site is first reached
     class profile_data
     {
     public:
-        mutable u64_t      t_ns       = 0;
-        mutable u64_t      hits       = 0;
-        mutable u64_t      complexity = 0;
         const char * const m_name;
+        const u32_t        m_id;
         explicit profile_data(const char * const);
     };
 
+    // Add a finished scope to the calling thread's counters, and to its trace while tracing
+    void record(u32_t id, u64_t t0, u64_t t1, u32_t complexity);
+
     class time_recorder_t
     {
     private:
-        profile_data * const                    m_pData;
-        const u32_t                             m_complexity;
-        const high_resolution_clock::time_point m_t;
+        const u32_t m_id;
+        const u32_t m_complexity;
+        const u64_t m_t;
 
     public:
-        explicit time_recorder_t(profile_data * const);
-        time_recorder_t(profile_data * const, const u32_t);
-        ~time_recorder_t();
+        explicit time_recorder_t(const profile_data & data, const u32_t complexity = 1) :
+            m_id(data.m_id), m_complexity(complexity), m_t(now())
+        {
+        }
+        ~time_recorder_t() { record(m_id, m_t, now(), m_complexity); }
+
+        time_recorder_t(const time_recorder_t &)             = delete;
+        time_recorder_t & operator=(const time_recorder_t &) = delete;
     };
 
+    // Totals per site over all threads. Call while no profiled scope is running; reset starts a new
+    // window for both the totals and the histograms.
     void output();
+    void reset();
 
-    class profile_t
+    // Distribution of a site's scope times since the last reset, in milliseconds. Every site keeps a
+    // log-linear histogram per thread, accurate to about 3%; max is exact.
+    struct percentiles_t
     {
-    public:
-        mutable std::vector<profile_data *> m_pointers;
-        void                                reg(profile_data * const pdata);
+        u64_t  hits = 0;
+        double p50  = 0;
+        double p90  = 0;
+        double p99  = 0;
+        double p999 = 0;
+        double max  = 0;
     };
 
-    static profile_t g_profile;
-} // namespace PLSC::DBG::PROFILE
+    // Sites sharing the name are merged, e.g. "update" for Solver::update. False if none has run.
+    bool percentiles(const char * name, percentiles_t & out);
 
-    #define PROFILE_MACRO_PASTE(id, name)                                                                    \
-        static PLSC::DBG::PROFILE::profile_data   _PROFILE_DATA##id(name);                                   \
-        const PLSC::DBG::PROFILE::time_recorder_t _PROFILE_RECORDER##id                                      \
-            = PLSC::DBG::PROFILE::time_recorder_t(&_PROFILE_DATA##id);
-    #define PROFILE_MACRO_EVAL(id, name) PROFILE_MACRO_PASTE(id, name)
+    // Record every scope as a Chrome trace event (chrome://tracing, ui.perfetto.dev) until the trace
+    // is written. Call between frames, while the pool is idle.
+    void traceStart();
+    bool traceWrite(const char * path);
+} // namespace PLSC::DBG::PROFILE
 
-    #define PROFILE()           PROFILE_MACRO_EVAL(__COUNTER__, __FUNCTION__)
-    #define PROFILE_NAMED(name) PROFILE_MACRO_EVAL(__COUNTER__, name)
+    #define PROFILE_MACRO_PASTE(id, name, complexity)                                                        \
+        static const PLSC::DBG::PROFILE::profile_data _PROFILE_DATA##id(name);                               \
+        const PLSC::DBG::PROFILE::time_recorder_t     _PROFILE_RECORDER##id(_PROFILE_DATA##id,               \
+                                                                        static_cast<u32_t>(complexity));
+    #define PROFILE_MACRO_EVAL(id, name, complexity) PROFILE_MACRO_PASTE(id, name, complexity)
 
-    #define PROFILE_MACRO_PASTE_COMPLEXITY(id, name, complexity)                                             \
-        static PLSC::DBG::PROFILE::profile_data   _PROFILE_DATA##id(name);                                   \
-        const PLSC::DBG::PROFILE::time_recorder_t _PROFILE_RECORDER##id                                      \
-            = PLSC::DBG::PROFILE::time_recorder_t(&_PROFILE_DATA##id, static_cast<size_t>(complexity));
-    #define PROFILE_MACRO_EVAL_COMPLEXITY(id, name, complexity)                                              \
-        PROFILE_MACRO_PASTE_COMPLEXITY(id, name, complexity)
+    #define PROFILE()           PROFILE_MACRO_EVAL(__COUNTER__, __FUNCTION__, 1)
+    #define PROFILE_NAMED(name) PROFILE_MACRO_EVAL(__COUNTER__, name, 1)
 
-    #define PROFILE_COMPLEXITY_NAMED(name, complexity)                                                       \
-        PROFILE_MACRO_EVAL_COMPLEXITY(__COUNTER__, name, complexity)
+    #define PROFILE_COMPLEXITY_NAMED(name, complexity) PROFILE_MACRO_EVAL(__COUNTER__, name, complexity)
     #define PROFILE_COMPLEXITY(complexity)                                                                   \
-        PROFILE_MACRO_EVAL_COMPLEXITY(__COUNTER__, __FUNCTION__, complexity)
-    #define PROFILE_OUTPUT() PLSC::DBG::PROFILE::output();
+        PROFILE_MACRO_EVAL(__COUNTER__, __FUNCTION__, complexity)
+
+    #define PROFILE_OUTPUT()          PLSC::DBG::PROFILE::output();
+    #define PROFILE_TRACE_START()     PLSC::DBG::PROFILE::traceStart();
+    #define PROFILE_TRACE_WRITE(path) PLSC::DBG::PROFILE::traceWrite(path);
 
 #else
     #define PROFILE()
@@ -75,4 +119,6 @@ namespace PLSC::DBG::PROFILE
     #define PROFILE_OUTPUT()
     #define PROFILE_COMPLEXITY(x)
     #define PROFILE_COMPLEXITY_NAMED(x, y)
-#endif
\ No newline at end of file
+    #define PROFILE_TRACE_START()
+    #define PROFILE_TRACE_WRITE(x)
+#endif
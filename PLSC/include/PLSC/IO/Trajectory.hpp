@@ -0,0 +1,147 @@
+#pragma once
+
+#include "PLSC/Math/vec2.hpp"
+#include "PLSC/Typedefs.hpp"
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace PLSC
+{
+    class Solver;
+}
+
+//- Trajectory files hold the particle positions of a run, one frame per recorded update, in id order up
+//- to Solver::idBound(); ids without a particle, after removals, decode as NaN. Each frame also lists the
+//- ids that went to another particle since they were last recorded, see ParticleStorage::generation().
+//- Positions are quantized to a fraction of a grid cell and stored as zigzag varint deltas against the
+//- previous frame, so particles at rest cost a byte per axis. Every KeyInterval-th frame is stored
+//- against zero, so playback can start there. Positions are in solver units, TrajectoryHeader::fScale
+//- converts them back to the units of SolverConfig.
+namespace PLSC::IO
+{
+    struct TrajectoryHeader
+    {
+        u32 uMagic        = 0;
+        u32 uVersion      = 0;
+        u32 uCapacity     = 0;
+        u32 uFractionBits = 0;
+        u32 uKeyInterval  = 0;
+        f32 fWidth        = 0;
+        f32 fHeight       = 0;
+        f32 fQuantum      = 0; // Solver units per step
+        f64 fScale        = 0; // SolverConfig::Scale()
+    };
+
+    // Records from the solver's thread and encodes and writes on its own. record() only gathers the
+    // positions into one of a few buffers, waiting only when all of them are still queued.
+    class TrajectoryWriter
+    {
+    public:
+        struct Options
+        {
+            u32 uBuffers      = 4;  // Frames in flight
+            u32 uKeyInterval  = 64; // Recorded frames between key frames
+            u32 uFractionBits = 8;  // Quantization steps per cell, as a power of two
+        };
+
+        struct Stats
+        {
+            u64 uFrames   = 0;
+            u64 uRawBytes = 0; // As two floats per particle
+            u64 uBytes    = 0; // Written
+            u64 uStalls   = 0; // Calls to record() that waited for a buffer
+        };
+
+        TrajectoryWriter() = default;
+        ~TrajectoryWriter() { close(); }
+
+        TrajectoryWriter(const TrajectoryWriter &)             = delete;
+        TrajectoryWriter & operator=(const TrajectoryWriter &) = delete;
+
+        bool open(const char * path, const Solver & solver, const Options & options);
+        bool open(const char * path, const Solver & solver) { return open(path, solver, Options()); }
+
+        // Queue the active particles' positions as frame solver.m_updates
+        void record(const Solver & solver);
+
+        // Write what is queued and close the file. False if any write failed.
+        bool close();
+
+        // Consistent once closed
+        const Stats & stats() const { return m_stats; }
+
+    private:
+        struct Buffer
+        {
+            std::vector<f32> vX, vY;
+            std::vector<u32> vGeneration;
+            u32              uFrame = 0;
+        };
+
+        std::FILE *         m_pFile = nullptr;
+        Options             m_options;
+        f32                 m_fInvQuantum = 0;
+        std::vector<Buffer> m_vBuffers;
+        std::vector<i32>    m_vPrevX, m_vPrevY; // Quantized, writer thread only
+        std::vector<u32>    m_vGeneration;      // Of the last particle recorded per id, writer thread only
+        std::vector<u8_t>   m_vEncoded;         // Writer thread only
+        Stats               m_stats;
+        bool                m_bFailed = false;
+
+        std::thread             m_thread;
+        std::mutex              m_mutex;
+        std::condition_variable m_cvQueued;
+        std::condition_variable m_cvFree;
+        u64                     m_uHead = 0; // Buffers queued
+        u64                     m_uTail = 0; // Buffers written
+        bool                    m_bQuit = false;
+
+        void writerMain();
+        void encode(const Buffer & b, u64 index);
+    };
+
+    class TrajectoryReader
+    {
+    public:
+        TrajectoryReader() = default;
+        ~TrajectoryReader() { close(); }
+
+        TrajectoryReader(const TrajectoryReader &)             = delete;
+        TrajectoryReader & operator=(const TrajectoryReader &) = delete;
+
+        bool open(const char * path);
+        void close();
+
+        const TrajectoryHeader & header() const { return m_header; }
+
+        // Decode the next frame into positions, indexed by particle id. False at the end of the file
+        // or on a damaged frame.
+        bool next(std::vector<vec2> & positions);
+
+        // Make the next call to next() return the first frame with an update count of at least
+        // frame, decoding forward from the key frame before it
+        bool seek(u32 frame);
+
+        // Update count of the last decoded frame
+        u32 frame() const { return m_uFrame; }
+
+        // Ids of the last decoded frame that hold another particle than when they last held one, e.g. a
+        // particle added after a removal. Their motion from earlier frames is not a trajectory.
+        const std::vector<u32> & replaced() const { return m_vReplaced; }
+
+    private:
+        std::FILE *       m_pFile = nullptr;
+        TrajectoryHeader  m_header;
+        long              m_uStart = 0; // First frame
+        std::vector<i32>  m_vPrevX, m_vPrevY;
+        std::vector<u8_t> m_vEncoded;
+        std::vector<u32>  m_vReplaced;
+        u32               m_uFrame = 0;
+
+        bool decode(u32 count, bool key, u32 replaced);
+    };
+} // namespace PLSC::IO
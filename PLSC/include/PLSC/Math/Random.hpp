@@ -0,0 +1,43 @@
+#pragma once
+
+#include "PLSC/Typedefs.hpp"
+
+namespace PLSC
+{
+    // Counter-based generator: value n of a key is SplitMix64 applied to key + n * Gamma. There is no
+    // hidden state besides the counter, so every solver owns one, any value can be recomputed on its
+    // own, and keys derived from (seed, stream) give independent sequences. Not for cryptography.
+    class Random
+    {
+    public:
+        static constexpr u64 Gamma = 0x9e3779b97f4a7c15ull;
+
+        explicit constexpr Random(const u64 seed = 0, const u64 stream = 0) :
+            m_uKey(mix(seed ^ mix(stream + Gamma)))
+        {
+        }
+
+        // SplitMix64 finaliser
+        static constexpr u64 mix(u64 z)
+        {
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            return z ^ (z >> 31);
+        }
+
+        constexpr u64 at(const u64 n) const { return mix(m_uKey + (n + 1) * Gamma); }
+        inline u64    next() { return at(m_uCounter++); }
+
+        // [0, 1) from the top 24 bits
+        inline f32 uniform() { return static_cast<f32>(next() >> 40) * (1.0f / 16777216.0f); }
+        inline f32 uniform(const f32 min, const f32 max) { return min + (max - min) * uniform(); }
+
+        // Values drawn so far; restoring it replays the sequence
+        constexpr u64 counter() const { return m_uCounter; }
+        inline void   seek(const u64 n) { m_uCounter = n; }
+
+    private:
+        u64 m_uKey;
+        u64 m_uCounter = 0;
+    };
+} // namespace PLSC
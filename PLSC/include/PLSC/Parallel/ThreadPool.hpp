@@ -0,0 +1,70 @@
+#pragma once
+
+#include "PLSC/Typedefs.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace PLSC::Parallel
+{
+    // Persistent fork-join pool for short, frequent parallel loops (several per substep).
+    // The calling thread always participates, so a pool of size N runs N-1 workers.
+    class ThreadPool
+    {
+    public:
+        explicit ThreadPool(u32 threads);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &)             = delete;
+        ThreadPool & operator=(const ThreadPool &) = delete;
+
+        u32 size() const { return static_cast<u32>(m_vThreads.size()) + 1u; }
+
+        // Run f(i) for every i in [0, n), blocking until all calls have returned.
+        // Indices are handed out dynamically, so f must not depend on which thread runs it.
+        template <typename F>
+        void forEach(const u32 n, F && f)
+        {
+            if (n == 0) return;
+            if (m_vThreads.empty() || n == 1)
+            {
+                for (u32 i = 0; i < n; ++i) f(i);
+                return;
+            }
+            using Fn = std::remove_reference_t<F>;
+            dispatch(n, &invoke<Fn>, const_cast<void *>(static_cast<const void *>(&f)));
+        }
+
+    private:
+        using task_fn = void (*)(void *, u32);
+
+        template <typename F>
+        static void invoke(void * ctx, const u32 i)
+        {
+            (*static_cast<F *>(ctx))(i);
+        }
+
+        void dispatch(u32 n, task_fn fn, void * ctx);
+        void work();
+        void workerMain();
+
+        std::vector<std::thread> m_vThreads;
+
+        std::mutex              m_mutex;
+        std::condition_variable m_cvStart;
+        std::condition_variable m_cvDone;
+
+        task_fn m_fn  = nullptr;
+        void *  m_ctx = nullptr;
+        u32     m_n   = 0;
+
+        std::atomic<u32> m_uNext {0};
+        u32              m_uGeneration = 0;
+        u32              m_uBusy       = 0;
+        bool             m_bQuit       = false;
+    };
+} // namespace PLSC::Parallel
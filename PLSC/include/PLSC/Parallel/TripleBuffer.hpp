@@ -0,0 +1,51 @@
+#pragma once
+
+#include "PLSC/Typedefs.hpp"
+
+#include <atomic>
+#include <cstddef>
+
+namespace PLSC::Parallel
+{
+    // Lock-free hand-off of the latest value from one writer thread to one reader thread. The writer
+    // fills back() and publishes it, the reader picks up the newest published value with acquire()
+    // and reads front() until its next acquire(). Neither ever waits for the other, and the three
+    // values are disjoint, so the reader never sees one half written. Values published while the
+    // reader is busy replace each other; only the newest is kept.
+    template <typename T>
+    class TripleBuffer
+    {
+    public:
+        static constexpr size_t CacheLine = 64;
+
+        //-- Writer
+        T & back() { return m_buffers[m_uBack]; }
+        void publish()
+        {
+            const u8_t fresh    = static_cast<u8_t>(m_uBack | Fresh);
+            const u8_t previous = m_uMiddle.exchange(fresh, std::memory_order_acq_rel);
+            m_uBack             = previous & Index;
+        }
+
+        //-- Reader. False, keeping front(), when nothing was published since the last call.
+        bool acquire()
+        {
+            if (!(m_uMiddle.load(std::memory_order_relaxed) & Fresh)) return false;
+            const u8_t previous = m_uMiddle.exchange(m_uFront, std::memory_order_acq_rel);
+            m_uFront            = previous & Index;
+            return true;
+        }
+        const T & front() const { return m_buffers[m_uFront]; }
+
+    private:
+        static constexpr u8_t Index = 3;
+        static constexpr u8_t Fresh = 4; // Set in m_uMiddle when it holds an unread value
+
+        T m_buffers[3];
+
+        // Each index is owned by one side, kept on its own line
+        alignas(CacheLine) std::atomic<u8_t> m_uMiddle {1};
+        alignas(CacheLine) u8_t m_uBack  = 0;
+        alignas(CacheLine) u8_t m_uFront = 2;
+    };
+} // namespace PLSC::Parallel
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "PLSC/Typedefs.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace PLSC::Parallel
+{
+    // Pool for independent tasks of uneven length, e.g. whole solvers rather than parts of one substep
+    // (see ThreadPool for those). Every thread owns a queue: it runs its newest task first, so a task
+    // that pushes its own continuation keeps its data in that thread's caches, and idle threads steal
+    // the oldest task of another queue. The thread calling wait() participates, so a pool of size N
+    // runs N-1 workers.
+    class WorkStealingPool
+    {
+    public:
+        using Task = std::function<void()>;
+
+        explicit WorkStealingPool(u32 threads);
+        ~WorkStealingPool();
+
+        WorkStealingPool(const WorkStealingPool &)             = delete;
+        WorkStealingPool & operator=(const WorkStealingPool &) = delete;
+
+        u32 size() const { return static_cast<u32>(m_vThreads.size()) + 1u; }
+
+        // Queue a task. From inside a task it goes to the running thread's queue, otherwise the queues
+        // take turns.
+        void push(Task task);
+
+        // Run tasks until every pushed task, including those pushed meanwhile, has returned
+        void wait();
+
+        // Tasks taken from another thread's queue since construction
+        u64 steals() const { return m_uSteals.load(std::memory_order_relaxed); }
+
+    private:
+        struct alignas(64) Queue
+        {
+            std::mutex       mutex;
+            std::deque<Task> tasks;
+        };
+
+        bool take(u32 self, Task & task);
+        void run(Task & task);
+        void workerMain(u32 self);
+
+        std::unique_ptr<Queue[]> m_queues;
+        std::vector<std::thread> m_vThreads;
+
+        std::mutex              m_mutex;
+        std::condition_variable m_cv; // Tasks queued, all tasks done, or quit
+
+        std::atomic<u64> m_uQueued {0};  // Pushed and not yet taken
+        std::atomic<u64> m_uPending {0}; // Pushed and not yet returned
+        std::atomic<u32> m_uNextQueue {0};
+        std::atomic<u64> m_uSteals {0};
+        bool             m_bQuit = false;
+    };
+} // namespace PLSC::Parallel
@@ -2,6 +2,7 @@
 
 #include "Particle.hpp"
 
+#include <cfloat> // FLT_MAX
 #include <memory>
 
 namespace PLSC::Collider
@@ -14,6 +15,15 @@ namespace PLSC::Collider
         virtual void         CollideFast(Particle *)      = 0;
         virtual const char * Name() const                 = 0;
 
+        // Box holding every position where Intersects can be true for particles up to radius r.
+        // Used to build the static grid; the default covers everything, which is correct but slow.
+        virtual void Bounds(const f32 r, vec2 & min, vec2 & max) const
+        {
+            (void) r;
+            min = vec2(-FLT_MAX, -FLT_MAX);
+            max = vec2(FLT_MAX, FLT_MAX);
+        }
+
         virtual ~ICollider() { }
     };
 } // namespace PLSC::Collider
@@ -41,6 +51,17 @@ namespace PLSC::Collider
         {
         }
 
+        // Exact copy of the stored centre and extent, which the bounds only give to within rounding
+        constexpr explicit AABB(const vec2 & c, const vec2 & e) :
+            extent(e),
+            C(c),
+            minX(C.x - extent.x),
+            minY(C.y - extent.y),
+            maxX(C.x + extent.x),
+            maxY(C.y + extent.y)
+        {
+        }
+
         constexpr f32 draw_minX() const { return C.x - extent.x + Constants::CircleRadius; }
         constexpr f32 draw_minY() const { return C.y - extent.y + Constants::CircleRadius; }
         constexpr f32 draw_maxX() const { return C.x + extent.x - Constants::CircleRadius; }
@@ -50,25 +71,38 @@ namespace PLSC::Collider
 
         virtual const char * Name() const final { return "AABB"; }
 
+        void Bounds(const f32 r, vec2 & min, vec2 & max) const final
+        {
+            const f32 dr = r - Constants::CircleRadius;
+            min          = vec2(minX - dr, minY - dr);
+            max          = vec2(maxX + dr, maxY + dr);
+        }
+
         inline bool Intersects(Particle * ob) const final
         {
-            return (ob->P.x > minX && ob->P.x < maxX && ob->P.y > minY && ob->P.y < maxY);
+            const f32 dr = ob->r - Constants::CircleRadius;
+            return (ob->P.x > minX - dr && ob->P.x < maxX + dr && ob->P.y > minY - dr
+                    && ob->P.y < maxY + dr);
         }
 
         inline bool Collide(Particle * ob) final
         {
-            if (ob->P.x < minX || ob->P.x > maxX || ob->P.y < minY || ob->P.y > maxY) return false;
+            // Bounds are inflated by CircleRadius, grow them by the difference for other radii
+            const f32 dr = ob->r - Constants::CircleRadius;
+            const f32 x0 = minX - dr, y0 = minY - dr, x1 = maxX + dr, y1 = maxY + dr;
+            if (ob->P.x < x0 || ob->P.x > x1 || ob->P.y < y0 || ob->P.y > y1) return false;
 
-            vec2       vd = ob->P - C;
-            const bool hz = extent.y - std::fabs(vd.y) >= extent.x - std::fabs(vd.x);
-            vd.x          = hz ? std::copysign(extent.x, vd.x) : vd.x;
-            vd.y          = !hz ? std::copysign(extent.y, vd.y) : vd.y;
+            const vec2 ext = vec2(extent.x + dr, extent.y + dr);
+            vec2       vd  = ob->P - C;
+            const bool hz  = ext.y - std::fabs(vd.y) >= ext.x - std::fabs(vd.x);
+            vd.x           = hz ? std::copysign(ext.x, vd.x) : vd.x;
+            vd.y           = !hz ? std::copysign(ext.y, vd.y) : vd.y;
 
             // Closest point outward
             ob->P = C + vd;
 
             // Reflect dP if outside
-            const vec2 dPclamp = vec2(clamp(ob->dP.x, minX, maxX), clamp(ob->dP.y, minY, maxY));
+            const vec2 dPclamp = vec2(clamp(ob->dP.x, x0, x1), clamp(ob->dP.y, y0, y1));
             const vec2 dPd     = dPclamp - ob->dP;
             ob->dP             = dPclamp + dPd;
 #ifdef PARTICLE_DBG_COLOR
@@ -96,6 +130,17 @@ namespace PLSC::Collider
         {
         }
 
+        // See AABB(c, e)
+        constexpr explicit InverseAABB(const vec2 & c, const vec2 & e) :
+            C(c),
+            extent(e),
+            minX(C.x - extent.x),
+            minY(C.y - extent.y),
+            maxX(C.x + extent.x),
+            maxY(C.y + extent.y)
+        {
+        }
+
         constexpr f32 draw_minX() const { return minX - Constants::CircleRadius; }
         constexpr f32 draw_minY() const { return minY - Constants::CircleRadius; }
         constexpr f32 draw_maxX() const { return maxX + Constants::CircleRadius; }
@@ -105,13 +150,20 @@ namespace PLSC::Collider
 
         inline bool Intersects(Particle * ob) const final
         {
-            return (ob->P.x < minX || ob->P.x > maxX || ob->P.y < minY || ob->P.y > maxY);
+            const f32 dr = ob->r - Constants::CircleRadius;
+            return (ob->P.x < minX + dr || ob->P.x > maxX - dr || ob->P.y < minY + dr
+                    || ob->P.y > maxY - dr);
         }
 
         inline bool Collide(Particle * ob) final
         {
             using namespace Constants;
 
+            // Bounds are shrunk by CircleRadius, shrink them by the difference for other radii
+            const f32 dr   = ob->r - CircleRadius;
+            const f32 minX = this->minX + dr, minY = this->minY + dr;
+            const f32 maxX = this->maxX - dr, maxY = this->maxY - dr;
+
             vec2 &P   = ob->P;
             vec2 &dP  = ob->dP;
             bool  ret = false;
@@ -164,9 +216,16 @@ namespace PLSC::Collider
 
         const char * Name() const final { return "Circle"; }
 
+        void Bounds(const f32 radius, vec2 & min, vec2 & max) const final
+        {
+            const f32 R = r + radius;
+            min         = vec2(P.x - R, P.y - R);
+            max         = vec2(P.x + R, P.y + R);
+        }
+
         inline bool Intersects(Particle * ob) const final
         {
-            const f32 R = r + Constants::CircleRadius;
+            const f32 R = r + ob->r;
             return (P.distSq(ob->P) < R * R);
         }
 
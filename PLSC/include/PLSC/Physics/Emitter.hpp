@@ -0,0 +1,35 @@
+#pragma once
+
+#include "PLSC/Math/vec2.hpp"
+#include "PLSC/Typedefs.hpp"
+
+namespace PLSC
+{
+    // Source of new particles, run by Solver::update() from Solver::m_emitters or once by
+    // Solver::emit(). Each particle goes to a random point of the shape, in solver units, where it
+    // overlaps no other particle; a particle that finds no free point in uTries attempts is dropped.
+    // Overlap with static colliders is not checked, so keep the shape clear of them.
+    struct Emitter
+    {
+        enum Shape : u32
+        {
+            Point,  // At A
+            Line,   // Along A to B
+            Region, // Inside the box of corners A and B
+        };
+
+        Shape uShape = Point;
+        vec2  A, B;
+
+        f32  fRate   = 1; // Particles per update, fractions carry over to the next one
+        vec2 V;           // Initial velocity, solver units per second
+        f32  fSpread = 0; // Largest random addition to V, in any direction
+        u32  uTries  = 8; // Positions tried per particle
+        u64  uLimit  = 0; // Particles to emit in total, 0 for no limit
+
+        //-- Progress
+        f32 fCarry   = 0;
+        u64 uEmitted = 0;
+        u64 uDropped = 0; // Found no free position
+    };
+} // namespace PLSC
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "PLSC/Math/Random.hpp"
+#include "PLSC/Parallel/WorkStealingPool.hpp"
+#include "PLSC/Typedefs.hpp"
+#include "Solver.hpp"
+#include "SolverConfig.hpp"
+
+#include <algorithm> // max, min
+#include <memory>
+#include <vector>
+
+namespace PLSC
+{
+    // Many independent runs of one config, e.g. Monte Carlo over Galton boards, one single threaded
+    // Solver each, spread over a WorkStealingPool. Runs advance BatchFrames updates per task and then
+    // queue their own continuation, so a thread keeps its run hot in cache while idle threads steal
+    // runs not started yet. A run's solver only exists between its first batch and its result, so
+    // memory follows the thread count rather than the number of runs.
+    class Ensemble
+    {
+    public:
+        struct Stats
+        {
+            u64 uRuns   = 0;
+            u64 uFrames = 0; // Updates over all runs
+            u64 uSteals = 0;
+        };
+
+        // config.Seed is the ensemble's seed; config.Threads and Verbose are ignored
+        explicit Ensemble(const SolverConfig & config, const u32 threads, const u32 batchFrames = 32) :
+            m_config(config),
+            m_uBatchFrames(std::max(batchFrames, 1u)),
+            m_pool(threads)
+        {
+        }
+
+        u32 threads() const { return m_pool.size(); }
+
+        // Seed of run i, independent across runs and reproducible from config.Seed
+        u64 seed(const u32 run) const { return Random(m_config.Seed, run).at(0); }
+
+        // Run [0, runs) up to frames updates each and return the result of every run, by run. Per run,
+        // setup(Solver &, u32 run) registers static colliders before Solver::init(), step(Solver &, u32
+        // run) is called before every update and ends the run early by returning false, and
+        // collect(const Solver &, u32 run) returns its Result. Runs only share the callbacks, which are
+        // called from many threads at once. Every run gives the same result for any thread count.
+        template <typename Result, typename Setup, typename Step, typename Collect>
+        std::vector<Result> run(u32 runs, u32 frames, Setup && setup, Step && step, Collect && collect);
+
+        // Of the last call to run()
+        const Stats & stats() const { return m_stats; }
+
+    private:
+        const SolverConfig         m_config;
+        const u32                  m_uBatchFrames;
+        Parallel::WorkStealingPool m_pool;
+        Stats                      m_stats;
+    };
+
+    template <typename Result, typename Setup, typename Step, typename Collect>
+    std::vector<Result> Ensemble::run(const u32 runs, const u32 frames, Setup && setup, Step && step,
+                                      Collect && collect)
+    {
+        struct Run
+        {
+            std::unique_ptr<Solver> pSolver;
+            u32                     uFrames = 0;
+        };
+        std::vector<Run>    state(runs);
+        std::vector<Result> results(runs);
+
+        // Tasks refer to this frame only, wait() returns once the last of them has
+        const auto batch = [&](const auto & self, const u32 i) -> void
+        {
+            Run & r = state[i];
+            if (!r.pSolver)
+            {
+                SolverConfig config = m_config;
+                config.Seed         = seed(i);
+                config.Threads      = 1;
+                config.Verbose      = false;
+                r.pSolver           = std::make_unique<Solver>(config);
+                setup(*r.pSolver, i);
+                r.pSolver->init();
+            }
+
+            const u32 end  = std::min(frames, r.uFrames + m_uBatchFrames);
+            bool      more = true;
+            for (; r.uFrames < end && (more = step(*r.pSolver, i)); ++r.uFrames) r.pSolver->update();
+            if (more && r.uFrames < frames)
+            {
+                m_pool.push([&self, i] { self(self, i); });
+                return;
+            }
+            results[i] = collect(static_cast<const Solver &>(*r.pSolver), i);
+            r.pSolver.reset();
+        };
+
+        const u64 steals = m_pool.steals();
+        for (u32 i = 0; i < runs; ++i) m_pool.push([&batch, i] { batch(batch, i); });
+        m_pool.wait();
+
+        m_stats         = Stats();
+        m_stats.uRuns   = runs;
+        m_stats.uSteals = m_pool.steals() - steals;
+        for (const Run & r : state) m_stats.uFrames += r.uFrames;
+        return results;
+    }
+} // namespace PLSC
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "PLSC/Constants.hpp"
+#include "PLSC/Math/vec2.hpp"
+#include "PLSC/Typedefs.hpp"
+#include "Particle.hpp"
+
+#include <cmath>
+
+namespace PLSC::Collider
+{
+    // Oriented box that the user moves between updates (paddles, pistons, rotating gates). Unlike the
+    // static colliders it is registered with Solver::addKinematic, is interpolated over the substeps of
+    // an update, and hands its own velocity to the particles it hits.
+    struct KinematicBox
+    {
+        vec2 C;         // Centre
+        vec2 extent;    // Half size
+        f32  angle = 0; // Radians, counter-clockwise
+
+        KinematicBox() = default;
+        constexpr explicit KinematicBox(const vec2 &c, const vec2 &e, const f32 a = 0.0f) :
+            C(c), extent(e), angle(a)
+        {
+        }
+
+        // Axis-aligned box around the collider, grown by a particle radius
+        inline void Bounds(const f32 r, vec2 &min, vec2 &max) const
+        {
+            const f32  c = std::fabs(std::cos(angle)), s = std::fabs(std::sin(angle));
+            const vec2 h = vec2(extent.x * c + extent.y * s + r, extent.x * s + extent.y * c + r);
+            min          = C - h;
+            max          = C + h;
+        }
+
+        // Push ob out of the box. v is the box velocity and w its angular velocity, both per substep.
+        // The particle velocity relative to the surface is reflected with StaticRestitution and its
+        // tangential part damped by StaticFrictionCoef, so a moving box carries particles along.
+        inline bool Collide(Particle *ob, const vec2 &v, const f32 w) const
+        {
+            using namespace Constants;
+            const f32 c = std::cos(angle), s = std::sin(angle);
+
+            // Into box space
+            const vec2 d   = ob->P - C;
+            vec2       l   = vec2(d.x * c + d.y * s, d.y * c - d.x * s);
+            const vec2 ext = vec2(extent.x + ob->r, extent.y + ob->r);
+            if (std::fabs(l.x) >= ext.x || std::fabs(l.y) >= ext.y) return false;
+
+            // Out along the axis of least penetration
+            vec2 n;
+            if (ext.x - std::fabs(l.x) < ext.y - std::fabs(l.y))
+            {
+                l.x = std::copysign(ext.x, l.x);
+                n   = vec2(std::copysign(1.0f, l.x), 0.0f);
+            }
+            else
+            {
+                l.y = std::copysign(ext.y, l.y);
+                n   = vec2(0.0f, std::copysign(1.0f, l.y));
+            }
+            const vec2 r  = vec2(l.x * c - l.y * s, l.x * s + l.y * c);
+            const vec2 nw = vec2(n.x * c - n.y * s, n.x * s + n.y * c);
+
+            // Velocity relative to the surface point
+            const vec2 vs = v + vec2(-r.y, r.x) * w;
+            vec2       vr = (ob->P - ob->dP) - vs;
+            const f32  vn = vr.dot(nw);
+            if (vn < 0.0f)
+            {
+                const vec2 vt = vr - nw * vn;
+                vr            = vt * StaticFrictionCoef - nw * (vn * StaticRestitution);
+            }
+
+            ob->P  = C + r;
+            ob->dP = ob->P - (vs + vr);
+            return true;
+        }
+    };
+} // namespace PLSC::Collider
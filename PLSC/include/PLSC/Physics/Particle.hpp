@@ -12,6 +12,7 @@ namespace PLSC
     struct Particle
     {
         vec2 P, dP;
+        f32  r = Constants::CircleRadius; // Only differs when polydisperse
 
         Particle() = default;
 
@@ -30,7 +31,7 @@ namespace PLSC
         {
             // "in joules"
             // TODO: Update if we add units.
-            return Constants::CircleHalfMass * std::fabs(P.distSq(dP));
+            return Constants::CircleHalfMass * (r * r * 4.0f) * std::fabs(P.distSq(dP));
         }
 
         inline bool Collide(Particle * ob)
@@ -49,9 +50,53 @@ namespace PLSC
             return false;
         }
 
-        inline void CollideFast(Particle * ob)
+        // Polydisperse collision, the correction is split by mass (area) rather than equally
+        inline void CollidePoly(f32 & x, f32 & y, const f32 r2)
         {
-            vec2  vd   = P - ob->P;
+            vec2        vd    = P - vec2(x, y);
+            const float dist  = std::fabs(vd.dot(vd));
+            const f32   reach = r + r2;
+            if (dist < reach * reach)
+            {
+                const f32 m1   = r * r;
+                const f32 m2   = r2 * r2;
+                const f32 rinv = dist > FLT_EPSILON ? rsqrt_fast(dist) : rsqrt_fast(Constants::CircleRadius);
+                vd *= Constants::PolyResponseCoef * (1.0f - reach * rinv) / (m1 + m2);
+                P -= vd * m2;
+                x += vd.x * m1;
+                y += vd.y * m1;
+            }
+        }
+
+        inline void CollideFast(Particle * ob) { CollideFast(ob->P.x, ob->P.y); }
+
+        // Collide against a sleeping particle. It stays put and this particle takes the whole correction,
+        // unless this particle moves faster than SleepLimit2; then the pair resolves as usual and true
+        // is returned. Overlap alone never wakes a sleeper, as the bottom of a pile is always compressed.
+        inline bool CollideResting(f32 & x, f32 & y)
+        {
+            vec2  vd   = P - vec2(x, y);
+            float dist = std::fabs(vd.dot(vd));
+            if (dist < (Constants::CircleDiameter))
+            {
+                vd *= Constants::ResponseCoef
+                      * (1.0f - rsqrt_fast(dist > FLT_EPSILON ? dist : Constants::CircleRadius));
+                if (P.distSq(dP) > Constants::SleepLimit2 * Constants::SleepLimit2)
+                {
+                    P -= vd;
+                    x += vd.x;
+                    y += vd.y;
+                    return true;
+                }
+                P -= vd + vd;
+            }
+            return false;
+        }
+
+        // Collide against a particle given by its position components, e.g. in a ParticleStorage
+        inline void CollideFast(f32 & x, f32 & y)
+        {
+            vec2  vd   = P - vec2(x, y);
             float dist = std::fabs(vd.dot(vd));
             if (dist < (Constants::CircleDiameter)) // + 0.005f))
             {
@@ -59,7 +104,8 @@ namespace PLSC
                 else
                     vd *= Constants::ResponseCoef * (1.0f - rsqrt_fast(Constants::CircleRadius));
                 P -= vd;
-                ob->P += vd;
+                x += vd.x;
+                y += vd.y;
             }
         }
     };
@@ -0,0 +1,174 @@
+#pragma once
+
+#include "PLSC/Constants.hpp"
+#include "PLSC/Math/vec2.hpp"
+#include "PLSC/Typedefs.hpp"
+#include "Particle.hpp"
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+namespace PLSC
+{
+    class ParticleRef;
+
+    // Structure-of-arrays particle storage. P and dP are kept as separate x/y arrays, each
+    // starting on a cache line, so passes that only touch positions stream contiguous floats.
+    class ParticleStorage
+    {
+    public:
+        static constexpr size_t Alignment = 64;
+        static constexpr u32    Lane      = Alignment / sizeof(f32);
+
+        f32 * Px  = nullptr;
+        f32 * Py  = nullptr;
+        f32 * dPx = nullptr;
+        f32 * dPy = nullptr;
+        f32 * R   = nullptr; // Per-particle radius, only allocated when polydisperse
+
+        // Substeps spent below Constants::SleepLimit, asleep at SleepSteps, and where that count began.
+        // Only allocated when sleeping.
+        u8_t * Rest = nullptr;
+        f32 *  Ax   = nullptr;
+        f32 *  Ay   = nullptr;
+
+        explicit ParticleStorage(u32 capacity, bool radii = false, bool sleeping = false);
+        ~ParticleStorage();
+
+        ParticleStorage(const ParticleStorage &)             = delete;
+        ParticleStorage & operator=(const ParticleStorage &) = delete;
+
+        u32 capacity() const { return m_uCapacity; }
+
+        // Stable identity of the particle stored in slot i, and the slot holding an identity. permute()
+        // and swap() move particles between slots but never change their identities, which start out as
+        // slots. Slots past the active ones hold the ids that particles added there receive.
+        inline u32 id(const u32 slot) const { return m_vIds.empty() ? slot : m_vIds[slot]; }
+        inline u32 slot(const u32 id) const { return m_vSlots.empty() ? id : m_vSlots[id]; }
+
+        // One past the largest id held by slots [0, n)
+        u32 idBound(u32 n) const;
+
+        // Times an id was given up by a removed particle, so a particle that receives it again can be told
+        // from the one before. retire() counts the removal of the particle in slot i.
+        inline u32 generation(const u32 id) const { return m_vGenerations.empty() ? 0 : m_vGenerations[id]; }
+        void       retire(u32 i);
+
+        // Generation of every id for checkpoints, null until the first retire()
+        const u32 * generations() const { return m_vGenerations.empty() ? nullptr : m_vGenerations.data(); }
+        void        setGenerations(const u32 * generations);
+
+        // Reorder slots [0, n), slot i receives the particle in slot order[i]
+        void permute(const u32 * order, u32 n);
+
+        // Exchange the particles in slots a and b, identities included
+        void swap(u32 a, u32 b);
+
+        // All arrays as one block of bytes(), for checkpoints. adopt() swaps in a block of the same
+        // layout, e.g. a private file mapping, which release frees in place of the allocator.
+        const void * data() const { return m_pBlock; }
+        size_t       bytes() const { return m_uBytes; }
+        void         adopt(void * block, std::function<void()> release);
+
+        // Set the slot -> id map of slots [0, n), or the identity when ids is null
+        bool hasIds() const { return !m_vIds.empty(); }
+        void setIds(const u32 * ids, u32 n);
+
+        inline bool asleep(const u32 i) const { return Rest && Rest[i] == Constants::SleepSteps; }
+        inline void wake(const u32 i) { Rest[i] = 0; }
+
+        inline Particle load(const u32 i) const
+        {
+            Particle ob(vec2(Px[i], Py[i]), vec2(dPx[i], dPy[i]));
+            if (R) ob.r = R[i];
+            return ob;
+        }
+        inline void store(const u32 i, const Particle & ob)
+        {
+            Px[i]  = ob.P.x;
+            Py[i]  = ob.P.y;
+            dPx[i] = ob.dP.x;
+            dPy[i] = ob.dP.y;
+            if (R) R[i] = ob.r;
+        }
+
+        inline ParticleRef operator[](u32 i);
+
+        // SoA counterparts of Particle::update / Particle::KE over [0, n)
+        void update(u32 n, const vec2 & gravity);
+        f32  KE(u32 n) const;
+
+        // update() that also raises speedSq to the largest squared speed |P - dP| of [0, n) before
+        // integrating and, with push, pushSq to the largest squared distance of P from x and y, then
+        // copies the integrated P to x and y. So with push, the next call measures how far collisions
+        // moved particles in between.
+        void update(u32 n, const vec2 & gravity, f32 * x, f32 * y, bool push, f32 & speedSq, f32 & pushSq);
+
+        // update() that also returns the largest squared distance of the integrated P of [0, n) from x and y
+        f32 update(u32 n, const vec2 & gravity, const f32 * x, const f32 * y);
+
+        // Multiply the velocities P - dP of [0, n) by k, for a change of time step
+        void scaleVelocity(u32 n, f32 k);
+
+        // 64-bit FNV-1a over the bits of P, dP, radius and Rest of slots [0, n) in id order, so the order
+        // of slots is ignored. Radius and Rest only count where they are allocated.
+        u64 checksum(u32 n) const;
+
+        // Sleep bookkeeping over [0, n), no-ops unless sleeping is enabled
+        void wake(u32 n, const vec2 & min, const vec2 & max);
+        void wakeAll(u32 n);
+        u32  countAsleep(u32 n) const;
+
+    private:
+        f32 *                 m_pBlock    = nullptr;
+        size_t                m_uBytes    = 0;
+        u32                   m_uCapacity = 0;
+        std::function<void()> m_freeBlock; // Frees an adopted block
+
+        std::vector<u32> m_vIds;         // Slot -> id, empty until the first permute
+        std::vector<u32> m_vSlots;       // Id -> slot
+        std::vector<u32> m_vGenerations; // Id -> generation, empty until the first retire
+        std::vector<f32> m_vScratch;    // Capacity, used by permute
+        std::vector<u32> m_vScratchIds; // Capacity, used by permute
+
+        void mkIds();
+        void point(bool radii, bool sleeping);
+        void release();
+    };
+
+    // Thin accessor for a single particle living in a ParticleStorage
+    class ParticleRef
+    {
+    private:
+        ParticleStorage * const m_pStorage;
+        const u32               m_id;
+
+    public:
+        ParticleRef(ParticleStorage * storage, const u32 i) : m_pStorage(storage), m_id(i) { }
+
+        inline u32  id() const { return m_id; }
+        inline vec2 P() const { return {m_pStorage->Px[m_id], m_pStorage->Py[m_id]}; }
+        inline vec2 dP() const { return {m_pStorage->dPx[m_id], m_pStorage->dPy[m_id]}; }
+        inline f32  r() const { return m_pStorage->R ? m_pStorage->R[m_id] : Constants::CircleRadius; }
+        inline void setP(const vec2 & p)
+        {
+            m_pStorage->Px[m_id] = p.x;
+            m_pStorage->Py[m_id] = p.y;
+        }
+        inline void setdP(const vec2 & d)
+        {
+            m_pStorage->dPx[m_id] = d.x;
+            m_pStorage->dPy[m_id] = d.y;
+        }
+
+        inline operator Particle() const { return m_pStorage->load(m_id); }
+        inline ParticleRef & operator=(const Particle & ob)
+        {
+            m_pStorage->store(m_id, ob);
+            return *this;
+        }
+    };
+
+    inline ParticleRef ParticleStorage::operator[](const u32 i) { return ParticleRef(this, i); }
+} // namespace PLSC
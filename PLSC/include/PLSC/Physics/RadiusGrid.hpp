@@ -1,14 +1,29 @@
 #pragma once
 
 #include "Collider.hpp"
+#include "Kinematic.hpp"
 #include "PLSC/Constants.hpp"
+#include "PLSC/Parallel/ThreadPool.hpp"
 #include "PLSC/Typedefs.hpp"
+#include "ParticleStorage.hpp"
+#include "SDF.hpp"
+#include "SolverConfig.hpp"
 
 #include <array>
 #include <memory>
 #include <vector>
 
 #define RADIUSGRID_ROWCOL_ORDER 1 // 0 = ROW, 1 = COL
+#define RADIUSGRID_STRIPES      1 // 1 = Collide in column stripes (multithreaded), requires COL order
+
+#if RADIUSGRID_STRIPES && RADIUSGRID_ROWCOL_ORDER == 0
+    #error "RADIUSGRID_STRIPES requires RADIUSGRID_ROWCOL_ORDER == 1"
+#endif
+
+// Define PLSC_FIXED_CONFIG to size the grid from Constants::CFG at compile time, so its
+// strides fold into the hot loops. Solvers must then be built with the world size of the default
+// SolverConfig; the RadiusGrid constructor throws std::invalid_argument otherwise.
+
 namespace PLSC
 {
     using id_t = u32;
@@ -19,12 +34,75 @@ namespace PLSC
         using VCollider = std::vector<collider_ptr>;
 
         //        explicit RadiusGrid(std::array<Particle, Constants::MaxDynamicInstances>);
-        explicit RadiusGrid(Particle * objects) : m_objects(objects) { }
+        RadiusGrid(ParticleStorage * objects, const SolverConfig & config);
         //            ~RadiusGrid();
 
         void update(u32);
         void mkStatic(VCollider &);
 
+        // Substeps of the next update, which kinematic colliders spread their moves over. Call between
+        // updates.
+        void setSubsteps(const u32 n) { m_uSubsteps = n; }
+        void setThreads(u32);
+        u32  threads() const { return m_pPool ? m_pPool->size() : 1u; }
+
+        struct ListStats
+        {
+            u64 uBuilds = 0; // Substeps that rebuilt the grid and neighbour lists
+            u64 uReuses = 0; // Substeps that reused them
+            u64 uPairs  = 0; // Pairs listed by the last build
+        };
+        const ListStats & listStats() const { return m_listStats; }
+
+        // Positions at the last neighbour list build, null without lists. An integration that measures
+        // the largest squared distance of a particle from them passes it to moved(), which spares the
+        // next update() checking the lists over every particle. It holds for that update alone.
+        const f32 * listX() const { return m_vListX.empty() ? nullptr : m_vListX.data(); }
+        const f32 * listY() const { return m_vListY.empty() ? nullptr : m_vListY.data(); }
+        void        moved(const f32 distanceSq) { m_fListMovedSq = distanceSq; }
+
+        // Wall time of update() since the last reset, in nanoseconds. Only measured with PLSC_PROFILE, so
+        // the hot path reads no clock otherwise and every time stays 0.
+        struct PhaseTimes
+        {
+            u64 uReconstruct = 0; // Grid rebuilds, including neighbour lists
+            u64 uCollide     = 0; // Static, kinematic and particle pairs
+        };
+        const PhaseTimes & phaseTimes() const { return m_phaseTimes; }
+        void               resetPhaseTimes() { m_phaseTimes = PhaseTimes(); }
+        static u64         PhaseClock(); // Nanoseconds with PLSC_PROFILE, else 0
+
+        // Kinematic colliders, at most MaxKinematic and only on the dense grid; addKinematic returns
+        // NoKinematic otherwise. A move is reached at the end of the next update.
+        static constexpr u32 MaxKinematic = 64;
+        static constexpr u32 NoKinematic  = ~0u;
+        u32                  addKinematic(const Collider::KinematicBox &);
+        void                 moveKinematic(u32, const Collider::KinematicBox &);
+        const Collider::KinematicBox & kinematic(const u32 i) const { return m_vKinematic[i].now; }
+
+        // Particle slots in grid order as of the last rebuild, a permutation of [0, active); null once
+        // removed() has run since
+        const id_t * order() const { return m_bRemapped ? nullptr : m_vDynamicGrid.data(); }
+        // Drop anything keyed by particle slot, after the storage was permuted
+        void invalidate()
+        {
+            m_uListActive = 0;
+            m_uPlaced     = 0;
+            m_bRemapped   = false;
+        }
+        // The storage swapped slot with last, the last active one, to remove the particle in slot. The
+        // grid follows the particle that moved, so query() stays usable; neighbour lists are dropped.
+        void removed(u32 slot, u32 last);
+
+        // Append the slots that the last rebuild placed in cells overlapping [min, max]. Particles have
+        // moved up to queryMargin() since, so callers widen the box by that and test positions.
+        void query(const vec2 & min, const vec2 & max, std::vector<id_t> & out) const;
+        f32  queryMargin() const { return m_fSkin * 0.5f + Constants::CircleRadius; }
+        // Slots [0, placed()) are in the grid query() sees, none before the first rebuild or after
+        // invalidate(). refresh() rebuilds it for query() alone.
+        u32  placed() const { return m_uPlaced; }
+        void refresh(u32 active);
+
     public:
         //-- Profiling data
         //        u64 m_uCollideObjects = 0;
@@ -35,30 +113,185 @@ namespace PLSC
         static constexpr id_t BfrSize   = 8;
         static constexpr f32  fBfrSize  = static_cast<f32>(BfrSize);
         static constexpr f32  fBfrSize2 = fBfrSize * 2.0f;
+
+        // Cells per world extent: two per diameter plus buffer on both sides
+        static constexpr id_t GridSize(const f32 extent)
+        {
+            return Constants::static_ceil<id_t>(extent * 2.0f) + (BfrSize * 4);
+        }
+
+        // Columns per stripe. Particles collide with columns x-2..x, so stripes of
+        // the same phase (every other stripe) never touch while StripeCols >= 2.
+        static constexpr id_t StripeCols = 8;
+        static_assert(StripeCols >= 2, "Stripes narrower than the neighbour window would race");
+
+        // Cells searched on each side by the neighbour lists of a skin. Stripes stay race free while a
+        // particle reaches no further than one stripe to the left, and the buffer holds the window.
+        static constexpr id_t ListWindow(const f32 skin)
+        {
+            return Constants::static_ceil<id_t>((Constants::CircleDiameter + skin) * 2.0f);
+        }
+
+#ifdef PLSC_FIXED_CONFIG
         static constexpr id_t XSize
             = Constants::static_ceil<id_t>(Constants::WorldWidth * 2.0f) + (BfrSize * 4);
         static constexpr id_t YSize
             = Constants::static_ceil<id_t>(Constants::WorldHeight * 2.0f) + (BfrSize * 4);
-        static constexpr id_t NSize = XSize * YSize;
+        static constexpr id_t NSize    = XSize * YSize;
+        static constexpr id_t NStripes = (XSize + StripeCols - 1) / StripeCols;
+#else
+        const id_t XSize;
+        const id_t YSize;
+        const id_t NSize;
+        const id_t NStripes;
+#endif
 
     private:
         //-- Member data
         //        std::array<Particle, Constants::MaxDynamicInstances> m_objects;
-        Particle *                  m_objects;
-        std::array<id_t, NSize + 1> m_aDynamicLUT = {0};
-        std::array<id_t, NSize + 1> m_aStaticLUT  = {0};
+        ParticleStorage * m_objects;
+        std::vector<id_t> m_vDynamicLUT; // NSize + 1
+        std::vector<id_t> m_vStaticLUT;  // NSize + 1
 
         //-- Min/max bounds used in reconstruct
         //        id_t m_uMinH = 0;
         //        id_t m_uMaxH = NSize;
 
-        std::array<id_t, Constants::MaxDynamicInstances> m_aDynamicGrid = {0};
-        VCollider                                        m_vStaticGrid;
+        std::vector<id_t> m_vDynamicGrid; // MaxInstances
+
+        //-- Static colliders, copied by type so the per-cell loop dispatches without virtual calls.
+        //-- Other ICollider implementations are kept by pointer and called virtually.
+        struct StaticEntry
+        {
+            enum Type : u32
+            {
+                AABB,
+                InverseAABB,
+                Circle,
+                SDF,
+                Virtual
+            };
+            Type uType;
+            u32  uIndex; // Into the array of its type
+        };
+        std::vector<StaticEntry>           m_vStaticGrid;
+        std::vector<Collider::AABB>        m_vAABBs;
+        std::vector<Collider::InverseAABB> m_vInverseAABBs;
+        std::vector<Collider::Circle>      m_vCircles;
+        std::vector<Collider::SDF>         m_vSDFs;
+        VCollider                          m_vVirtual;
+
+        //-- Kinematic colliders. Every cell has a bit per kinematic collider that may reach it, only
+        //-- the cells a collider leaves or enters are touched when it moves.
+        struct KinematicState
+        {
+            Collider::KinematicBox from, to, now;
+            vec2                   v;                              // Per substep
+            f32                    w  = 0;                         // Per substep
+            id_t                   x0 = 1, y0 = 1, x1 = 0, y1 = 0; // Covered cells, inclusive
+        };
+        std::vector<KinematicState> m_vKinematic;
+        std::vector<u64>            m_vKinematicMask; // NSize once a kinematic collider exists
+        u32                         m_uSubsteps;
+        u32                         m_uKinematicStep = 0;
+
+        //-- Cells holding at least one awake particle, NSize when sleeping is enabled, otherwise empty
+        std::vector<u8_t> m_vAwakeCells;
+
+        //-- Polydisperse size classes, empty when monodisperse. Level L has cells of CircleRadius * 2^L,
+        //-- holds the particles with radii up to that size and owns a contiguous part of m_vDynamicGrid.
+        struct Level
+        {
+            f32               fInvCell;
+            id_t              XSize, YSize;
+            id_t              uStart = 0, uCount = 0;
+            std::vector<id_t> vLUT; // XSize * YSize + 1
+
+            inline id_t hash(f32, f32) const;
+        };
+        std::vector<Level> m_vLevels;
+        const f32          m_fMaxRadius;
+        const bool         m_bVerbose;
+
+        //-- Sparse grid, empty unless SolverConfig::SparseGrid. Chunks of ChunkSize^2 cells, column ordered
+        //-- inside, are allocated where a particle or static collider first is and found by their
+        //-- coordinates through a hash table. Rebuilds only clear and scan the chunks holding particles,
+        //-- and chunks left empty for at least IdleRebuilds rebuilds are freed.
+        static constexpr i32  ChunkBits    = 4;
+        static constexpr i32  ChunkSize    = 1 << ChunkBits;
+        static constexpr id_t ChunkCells   = ChunkSize * ChunkSize;
+        static constexpr id_t NoChunk      = ~id_t(0);
+        static constexpr u32  IdleRebuilds = 8;
+        static_assert(ChunkSize >= 3, "Neighbourhoods may span at most two chunks per axis");
+
+        // Open addressing from packed chunk coordinates to an index, sized to a power of two
+        struct ChunkTable
+        {
+            std::vector<u64>  vKeys;
+            std::vector<id_t> vIndex; // NoChunk where empty
+
+            static u64 key(i32 cx, i32 cy);
+            id_t       find(u64) const;
+            void       insert(u64, id_t);
+            void       clear(size_t capacity);
+        };
+
+        struct Chunk
+        {
+            i32  cx, cy;
+            id_t uCount  = 0;
+            u32  uUsed   = 0;       // Last rebuild that placed particles here
+            id_t uStatic = NoChunk; // Into m_vStaticChunks
+            id_t aNear[6];          // Chunks (cx - 1 .. cx, cy - 1 .. cy + 1), [4] is this one
+
+            std::array<id_t, ChunkCells + 1> aLUT {}; // Into m_vDynamicGrid
+        };
+        struct StaticChunk
+        {
+            std::array<id_t, ChunkCells + 1> aLUT {}; // Into m_vStaticGrid
+        };
+        const bool               m_bSparse;
+        std::vector<Chunk>       m_vChunks;
+        u32                      m_uChunkRebuilds = 0;
+        ChunkTable               m_chunkTable;
+        std::vector<id_t>        m_vActiveChunks;    // Holding particles, by column after a rebuild
+        std::vector<u32>         m_vChunkColumns[2]; // Begin, end in m_vActiveChunks per column, by cx parity
+        std::vector<u32>         m_vCellOf;          // Chunk << 2 * ChunkBits | cell, per particle slot
+        std::vector<StaticChunk> m_vStaticChunks;
+        ChunkTable               m_staticTable;
+
+        //-- Verlet neighbour lists, empty unless a skin is configured. Every pair closer than 1 + skin is
+        //-- listed once, by grid position, and the lists are reused until a particle has moved skin / 2.
+        const f32         m_fSkin;
+        const id_t        m_uListWindow; // Cells to search on each side
+        std::vector<id_t> m_vListStart;  // MaxInstances + 1
+        std::vector<id_t> m_vLists;
+        std::vector<f32>  m_vListX; // Positions at the last build
+        std::vector<f32>  m_vListY;
+        u32               m_uListActive  = 0;
+        f32               m_fListMovedSq = -1; // From moved(), negative when unknown
+        ListStats         m_listStats;
+
+        //-- Jacobi collisions, empty unless SolverConfig::JacobiCollide. Per particle slot, the summed
+        //-- corrections of its contacts and their number, each written by that particle alone.
+        const f32         m_fJacobiRelax;
+        std::vector<f32>  m_vJacobiX; // MaxInstances
+        std::vector<f32>  m_vJacobiY;
+        std::vector<id_t> m_vJacobiN;
+
+        PhaseTimes m_phaseTimes;
 
 #ifdef COUNT_COLLISION_PAIRS
         DBG::PairCounter<Constants::MaxDynamicInstances> m_dbgPairCounter;
 #endif
         u32 m_uUpdates = 0;
+        u32 m_uPlaced  = 0;
+
+        //-- Removals since the last rebuild. Grid entries of removed particles name slots past m_uPlaced.
+        bool              m_bRemapped = false;
+        std::vector<id_t> m_vGridIndex; // Slot -> index into m_vDynamicGrid, built by the first removal
+
+        std::unique_ptr<Parallel::ThreadPool> m_pPool;
 
         id_t Ix(f32) const;
         id_t Iy(f32) const;
@@ -69,9 +302,48 @@ namespace PLSC
         id_t hash(const Particle &) const;
         id_t hash(f32, f32) const;
         id_t hash(id_t, id_t) const;
+        // hash() with the stride between columns (rows in row order) held by the caller. Loops that store
+        // ids read the runtime sizes once that way, as the stores could alias them.
+        id_t stride() const;
+        id_t hash(f32, f32, id_t) const;
         void reconstruct(id_t);
+        void collideStatic(Particle &, id_t);
+        void collideStatic(Particle &, id_t, id_t);
+        bool collideKinematic(Particle &, id_t) const;
+        void cover(u32, const vec2 &, const vec2 &);
+        void stepKinematic();
         // void collideStatic(const u32, const u32);
+        void collide(u32);
+        void collideStripes();
+        template <bool Sleeping>
         void collideSubset(u32, u32);
+        void collideRange(u32, u32);
+        void collideJacobi(u32);
+        void accumulateJacobi(u32, u32);
+        void applyJacobi(u32, u32);
+        void collideCandidates(Particle &, const id_t *, u32);
+        bool awakeNear(id_t) const;
+        void collideSleeper(Particle &, id_t, const id_t *, u32);
+        bool listsValid(u32) const;
+        void buildLists(u32);
+        template <bool Sleeping>
+        void collideLists(u32, u32);
+        u32  levelOf(f32) const;
+        void reconstructLevels(u32);
+        void collideLevel(u32, u32, u32);
+        void collideLevels(u32);
+        void collidePolyCandidates(Particle &, const id_t *, u32);
+        id_t mkChunk(i32, i32);
+        void mkStaticSparse(const std::vector<std::vector<std::pair<u64, u32>>> &,
+                            const std::vector<StaticEntry> &);
+        void reconstructSparse(u32);
+        void collideSparse();
+        void collideChunk(id_t);
     };
 
+    static_assert(RadiusGrid::ListWindow(static_cast<f32>(SolverConfig::MaxNeighbourSkin))
+                          <= RadiusGrid::StripeCols
+                      && RadiusGrid::ListWindow(static_cast<f32>(SolverConfig::MaxNeighbourSkin))
+                             < RadiusGrid::BfrSize * 2,
+                  "SolverConfig::MaxNeighbourSkin reaches past a stripe or the grid buffer");
 } // namespace PLSC
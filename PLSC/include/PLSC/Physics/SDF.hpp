@@ -0,0 +1,124 @@
+#pragma once
+
+#include "Collider.hpp"
+#include "PLSC/Constants.hpp"
+#include "PLSC/Math/vec2.hpp"
+#include "PLSC/Typedefs.hpp"
+#include "Particle.hpp"
+
+#include <cfloat> // FLT_EPSILON
+#include <cmath>
+#include <memory>
+#include <vector>
+
+namespace PLSC::Collider
+{
+    // Static geometry given as a baked signed distance field, negative inside the solid. A collision
+    // is one bilinear sample of distance and gradient followed by a projection along the gradient,
+    // so the cost per particle does not depend on how intricate the geometry is.
+    //
+    // The field covers the geometry plus a margin and distances are clamped to the margin, so neither
+    // particles outside of it nor those deeper inside the solid see the collider. Baked fields are
+    // shared between copies.
+    struct SDF : public ICollider
+    {
+        struct Sample
+        {
+            f32 d;      // Signed distance
+            f32 gx, gy; // Gradient, not normalized
+        };
+
+        struct Field
+        {
+            vec2                origin; // Position of sample 0
+            f32                 cell = 0, inv = 0;
+            f32                 margin = 0; // Distances are clamped to [-margin, margin]
+            u32                 nx = 0, ny = 0;
+            std::vector<Sample> samples; // Row major, nx * ny
+        };
+
+        std::shared_ptr<const Field> field;
+
+        explicit SDF(std::shared_ptr<const Field> f) : field(std::move(f)) { }
+
+        // Open polyline, solid within thickness / 2 of it. Funnels and terrain.
+        static SDF FromPolyline(const std::vector<vec2> &points, f32 thickness, f32 cell = 0.5f,
+                                f32 margin = 4.0f);
+
+        // Closed polygon, solid inside, or outside when inverted (a container).
+        static SDF FromPolygon(const std::vector<vec2> &points, bool inverted = false, f32 cell = 0.5f,
+                               f32 margin = 4.0f);
+
+        // 8-bit bitmap, pixels at or above threshold are solid. Pixel (0, 0) is centred on origin and
+        // each pixel is one sample.
+        static SDF FromBitmap(const u8_t *pixels, u32 width, u32 height, const vec2 &origin,
+                              f32 pixelSize = 0.5f, u8_t threshold = 128, f32 margin = 4.0f);
+
+        const char *Name() const final { return "SDF"; }
+
+        void Bounds(const f32 r, vec2 &min, vec2 &max) const final
+        {
+            (void) r;
+            min = field->origin;
+            max = field->origin
+                  + vec2(static_cast<f32>(field->nx - 1), static_cast<f32>(field->ny - 1)) * field->cell;
+        }
+
+        // Bilinear distance and gradient at p, false outside the field
+        inline bool At(const vec2 &p, f32 &d, vec2 &g) const
+        {
+            const Field &f = *field;
+            const f32    x = (p.x - f.origin.x) * f.inv;
+            const f32    y = (p.y - f.origin.y) * f.inv;
+            if (!(x >= 0.0f && y >= 0.0f && x < static_cast<f32>(f.nx - 1) && y < static_cast<f32>(f.ny - 1)))
+                return false;
+
+            const u32     ix = static_cast<u32>(x), iy = static_cast<u32>(y);
+            const f32     fx = x - static_cast<f32>(ix), fy = y - static_cast<f32>(iy);
+            const Sample *s  = f.samples.data() + iy * f.nx + ix;
+            const Sample &a = s[0], &b = s[1], &c = s[f.nx], &e = s[f.nx + 1];
+
+            const f32 w00 = (1.0f - fx) * (1.0f - fy), w10 = fx * (1.0f - fy);
+            const f32 w01 = (1.0f - fx) * fy, w11 = fx * fy;
+            d   = a.d * w00 + b.d * w10 + c.d * w01 + e.d * w11;
+            g.x = a.gx * w00 + b.gx * w10 + c.gx * w01 + e.gx * w11;
+            g.y = a.gy * w00 + b.gy * w10 + c.gy * w01 + e.gy * w11;
+            return true;
+        }
+
+        inline bool Intersects(Particle *ob) const final
+        {
+            f32  d;
+            vec2 g;
+            // Not where the field is clamped, where Collide does nothing either, so the static grid
+            // holds the cells near the surface rather than the whole interior
+            return At(ob->P, d, g) && d < ob->r && d > -field->margin && g.magSq() >= FLT_EPSILON;
+        }
+
+        inline bool Collide(Particle *ob) final
+        {
+            using namespace Constants;
+            f32  d;
+            vec2 g;
+            if (!At(ob->P, d, g) || d >= ob->r) return false;
+
+            // Flat where the field was clamped, deeper than its margin
+            const f32 g2 = g.magSq();
+            if (g2 < FLT_EPSILON) return false;
+            const vec2 n = g / std::sqrt(g2);
+
+            // Out along the gradient, the velocity reflected as by the other static colliders
+            vec2 v = ob->P - ob->dP;
+            ob->P += n * (ob->r - d);
+            const f32 vn = v.dot(n);
+            if (vn < 0.0f) v = (v - n * vn) * StaticFrictionCoef - n * (vn * StaticRestitution);
+            ob->dP = ob->P - v;
+#ifdef PARTICLE_DBG_COLOR
+            ob->dbgColStatic += DBG_COL_INCR;
+#endif
+            return true;
+        }
+
+        inline void CollideFast(Particle *ob) final { Collide(ob); }
+    };
+} // namespace PLSC::Collider
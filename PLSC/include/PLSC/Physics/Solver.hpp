@@ -1,13 +1,20 @@
 #pragma once
 
 #include "PLSC/Constants.hpp"
+#include "PLSC/Math/Random.hpp"
 #include "PLSC/Math/vec2.hpp"
+#include "PLSC/Parallel/TripleBuffer.hpp"
 #include "PLSC/Typedefs.hpp"
+#include "Emitter.hpp"
 #include "Particle.hpp"
+#include "ParticleStorage.hpp"
 #include "RadiusGrid.hpp"
+#include "SolverConfig.hpp"
 #include "Static.hpp"
 
-#include <array>
+#include <algorithm> // max, min
+#include <memory>
+#include <vector>
 
 namespace PLSC
 {
@@ -15,29 +22,167 @@ namespace PLSC
     class Solver
     {
     public:
-        Solver() : m_collisionStructure(&m_objects[0]) { }
+        explicit Solver(const SolverConfig & config = SolverConfig()) :
+            m_config(config),
+            m_objects(config.MaxInstances, config.Polydisperse(), config.Sleeps()),
+            m_gravity(config.GravityPosition()),
+            m_random(config.Seed),
+            m_collisionStructure(&m_objects, config),
+            m_lastGravity(m_gravity)
+        {
+            setThreads(config.Threads);
+            if (config.AdaptiveSubstep)
+            {
+                m_uSubsteps = std::min(std::max(config.Substep, config.SubstepLow()), config.SubstepHigh());
+                m_vPrevX.resize(config.MaxInstances);
+                m_vPrevY.resize(config.MaxInstances);
+                m_collisionStructure.setSubsteps(m_uSubsteps);
+            }
+        }
+
+        const SolverConfig m_config;
+        ParticleStorage    m_objects;
+        Static::Definition m_static;
+
+        // Removal regions: at the end of every update, particles that one of these intersects are
+        // removed, as by remove(). An InverseAABB removes the particles leaving it. Not saved by save().
+        Static::Definition m_sinks;
 
-        std::array<Particle, Constants::MaxDynamicInstances> m_objects;
-        Static::Definition                                   m_static;
+        // Run at the start of every update, each adding its share of fRate particles. Not saved by save().
+        std::vector<Emitter> m_emitters;
 
-        u32  m_active  = 0u;
-        u32  m_updates = 0u;
-        vec2 m_gravity = Constants::GravityPosition;
+        u32    m_active  = 0u;
+        u32    m_updates = 0u;
+        vec2   m_gravity;
+        Random m_random; // Used by spawnRandom and emitters
 
         void init();
         void update();
+
+        // Sort particle storage into the grid order of the last update, see SolverConfig::ReorderInterval.
+        // Does nothing unless that grid holds every active particle and none was removed since, e.g. after
+        // particles were added.
+        void reorder();
+
+        // One row of particles at random heights in the top half, without overlap checks. Emitters
+        // place particles clear of each other and are the better fit for anything but the demos.
         void spawnRandom();
-        f32  getKE()
+
+        // Add up to count particles from e at once, as an update would for one with fRate = count, and
+        // return how many. Overlaps are found through the grid of the last update and a hash of the
+        // particles added since, so the cost grows with count rather than with m_active.
+        u32 emit(Emitter & e, u32 count);
+
+        // Remove a particle, false if no active particle has this id. The last active particle moves into
+        // its slot, so particles keep their ids but may change slots, as with reorder(). The freed slot
+        // and id go to the next particle added at m_active, under the next ParticleStorage::generation()
+        // of the id. Call between updates.
+        bool remove(u32 id);
+
+        // Particles removed so far, by remove() or a sink
+        u64 removed() const { return m_uRemoved; }
+
+        // One past the largest id of an active particle, m_active until particles were removed
+        u32 idBound() const { return m_objects.idBound(m_active); }
+
+        // Kinematic colliders are not part of m_static. Each update moves them from their current pose
+        // to the one last given to moveKinematic, pushing particles along. addKinematic returns the
+        // collider's index, or RadiusGrid::NoKinematic once RadiusGrid::MaxKinematic are in use or
+        // with SolverConfig::SparseGrid.
+        u32                            addKinematic(const Collider::KinematicBox & box);
+        void                           moveKinematic(u32 i, const Collider::KinematicBox & box);
+        const Collider::KinematicBox & getKinematic(u32 i) const { return m_collisionStructure.kinematic(i); }
+
+        void setThreads(u32 n) { m_collisionStructure.setThreads(n); }
+        f32  getKE() const { return m_objects.KE(m_active); }
+
+        // Versioned binary snapshot of the particles, gravity, random sequence and static colliders, see
+        // Checkpoint.cpp. A loaded solver continues exactly as the saved one would have; kinematic
+        // colliders are not saved. load() needs a solver of the same config and replaces m_static. With
+        // map the particle arrays are the file's own pages, copy on write, so only what is touched gets
+        // read. False on failure, load() then leaves the solver as it was; save() fails on colliders
+        // other than the built-in ones, which load() could not recreate.
+        bool save(const char * path) const;
+        bool load(const char * path, bool map = true);
+
+        // Hash of the exact bits of every active particle in id order, for asserting that two runs match
+        u64 checksum() const { return m_objects.checksum(m_active); }
+
+        // Wake the sleeping particles inside a region, e.g. one swept by a moved collider. Changing
+        // m_gravity wakes every particle on the next update.
+        void wake(const vec2 & min, const vec2 & max) { m_objects.wake(m_active, min, max); }
+        u32  getAsleep() const { return m_objects.countAsleep(m_active); }
+
+        // Neighbour list rebuilds and reuses, see SolverConfig::NeighbourSkin
+        const RadiusGrid::ListStats & listStats() const { return m_collisionStructure.listStats(); }
+
+        // Substeps of the last update and the next one, m_config.Substep unless
+        // SolverConfig::AdaptiveSubstep
+        u32 substeps() const { return m_uLastSubsteps; }
+        u32 nextSubsteps() const { return m_uSubsteps; }
+
+        // Positions of the active particles after an update, indexed by id up to idBound(). Ids without
+        // a particle hold NaN. An id whose generation differs from an earlier snapshot went to another
+        // particle in between, e.g. one added after a removal.
+        struct Snapshot
         {
-            f32 sum = 0;
-            for (u32 i = 0; i < m_active; ++i) { sum += m_objects[i].KE(); }
-            return sum;
-        }
+            u32               uFrame = 0; // m_updates
+            std::vector<vec2> vP;
+            std::vector<u32>  vGeneration; // ParticleStorage::generation() per id
+        };
+        using SnapshotBuffer = Parallel::TripleBuffer<Snapshot>;
+
+        // A buffer that receives a snapshot at the end of every update, for one reader thread, which
+        // can then read a whole frame while the next update runs. Every reader subscribes on its own.
+        // Call between updates; dropping the returned pointer unsubscribes.
+        std::shared_ptr<SnapshotBuffer> subscribe();
+
+        // Wall time per phase of the substeps since the last reset, in nanoseconds; 0 without PLSC_PROFILE
+        struct PhaseTimes
+        {
+            u64 uReconstruct      = 0;
+            u64 uCollide          = 0;
+            u64 uIntegrate        = 0;
+            u64 uParticleSubsteps = 0; // Active particles summed over substeps
+            u64 uSubsteps         = 0; // Over updates, see substeps()
+            u64 uUpdates          = 0;
+        };
+        PhaseTimes phaseTimes() const;
+        void       resetPhaseTimes();
 
     private:
         RadiusGrid m_collisionStructure;
+        vec2       m_lastGravity;
+        u64        m_uIntegrateNs      = 0;
+        u64        m_uParticleSubsteps = 0;
+        u64        m_uRemoved          = 0;
+
+        //-- Adaptive substeps. The positions the last integration left, to measure collision pushes by.
+        u32              m_uSubsteps     = m_config.Substep; // Of the next update
+        u32              m_uLastSubsteps = m_config.Substep;
+        f32              m_fNextPush     = -1; // Last-substep push of the next update at rest, < 0 unknown
+        u64              m_uSubstepsRun  = 0;
+        u64              m_uUpdatesRun   = 0;
+        std::vector<f32> m_vPrevX;
+        std::vector<f32> m_vPrevY;
+
+        std::vector<std::shared_ptr<SnapshotBuffer>> m_vSnapshots;
+
+        //-- Scratch of emit() and sink(): grid query results, sunk slots, and a hash of the particles the
+        //-- grid does not hold
+        std::vector<id_t> m_vNear;
+        std::vector<u64>  m_vEmitKeys;
+        std::vector<u32>  m_vEmitHeads; // First particle per hash slot, by index past placed()
+        std::vector<u32>  m_vEmitNext;
+        std::vector<u32>  m_vSunk;
 
-        void updateObjects();
+        void append(const Particle & ob);
+        void adapt(f32 travelSq, f32 pushSq);
+        void publish();
+        void removeSlot(u32 slot);
+        void wakeNear(const vec2 & P);
+        void sink();
+        void updateObjects(const vec2 & gravity);
         void updateCollisions();
     };
 
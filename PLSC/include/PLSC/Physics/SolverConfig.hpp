@@ -0,0 +1,149 @@
+#pragma once
+
+#include "PLSC/Constants.hpp"
+#include "PLSC/Math/vec2.hpp"
+#include "PLSC/Typedefs.hpp"
+
+namespace PLSC
+{
+    // Runtime sizing of a Solver. User fields use the same units as Constants::CFG, which also
+    // provides the defaults; the derived values are in solver units, where a particle radius is 0.5.
+    struct SolverConfig
+    {
+        using number = Constants::number;
+
+        //-- User definitions
+        number WorldWidth   = Constants::CFG::WorldWidth;
+        number WorldHeight  = Constants::CFG::WorldHeight;
+        number CircleRadius = Constants::CFG::CircleRadius;
+        u32    MaxInstances = static_cast<u32>(Constants::CFG::MaxInstances);
+        u32    Substep      = static_cast<u32>(Constants::CFG::Substep);
+        number FixedTime    = Constants::CFG::FixedTime;
+        number Gravity1d    = Constants::CFG::Gravity1d;
+        u32    Threads      = 1;
+
+        // Polydisperse radii: particles range from CircleRadius to MaxRadiusScale times it.
+        // 1 keeps the monodisperse fast path. Polydisperse solvers ignore Sleeping, NeighbourSkin,
+        // SparseGrid and JacobiCollide.
+        number MaxRadiusScale = 1;
+
+        // Let particles that stay below Constants::SleepLimit sleep until something disturbs them.
+        // Sleepers are still placed in the grid and walked past every substep, so this only pays off
+        // when most particles stay asleep. Ignored by polydisperse solvers, the sparse grid and Jacobi.
+        bool Sleeping = false;
+
+        // Extra reach of the per-particle neighbour lists, in particle diameters. Lists are reused
+        // until a particle has moved half of it; 0 rebuilds the grid every substep instead. Clamped to
+        // MaxNeighbourSkin, beyond which lists would reach across a collision stripe. Ignored by
+        // polydisperse solvers, the sparse grid and Jacobi.
+        number                  NeighbourSkin    = 0;
+        static constexpr number MaxNeighbourSkin = 3;
+
+        // Frames between sorting particle storage into grid order, so neighbours are mostly adjacent
+        // in memory. Slots then change; ParticleStorage::id() keeps identities stable. 0 never sorts.
+        u32 ReorderInterval = 0;
+
+        // Grid made of chunks allocated where particles are, rather than cells over the whole world, so
+        // memory and the cost per substep follow the occupied area. For large worlds with localized
+        // activity; particles are not confined to the world either. Ignored by polydisperse solvers.
+        // Turns off Sleeping, NeighbourSkin and JacobiCollide, and addKinematic returns NoKinematic.
+        bool SparseGrid = false;
+
+        // Choose the substeps of every update from the motion in the last one, within [MinSubstep,
+        // MaxSubstep], aiming for no particle to move more than SubstepTravel per substep, nor collisions
+        // to push particles more than SubstepPush in the last substep, both in particle diameters. Most
+        // of that push is the steady weight of piles, so it raises the count up to Substep at most; only
+        // travel, or a push growing by more than SubstepPush between updates, go beyond. Scenes that are
+        // stable at Substep then take at most Substep, calm ones fewer. Substep remains the first count
+        // and the unit of m_gravity and of velocities (P - dP) between updates; the sleep limits are per
+        // substep, whatever its length.
+        bool   AdaptiveSubstep = false;
+        u32    MinSubstep      = 2;
+        u32    MaxSubstep      = 48;
+        number SubstepTravel   = 0.75;
+        number SubstepPush     = 0.2;
+
+        // Resolve particle pairs Jacobi style rather than Gauss-Seidel: every particle sums the
+        // corrections of its contacts from the positions at the start of the substep, then all of them
+        // move by JacobiRelaxation times their average at once. At 2 a lone contact separates in one
+        // substep; much more overshoots in piles. Piles need about twice the substeps for the same
+        // overlap, but the result ignores particle order and both passes spread over any number of
+        // threads without stripes. Ignored by polydisperse solvers and the sparse grid. Turns off
+        // Sleeping and NeighbourSkin.
+        bool   JacobiCollide    = false;
+        number JacobiRelaxation = 2;
+
+        // Report setup details, such as the size of the static collider grid or settings ignored by the
+        // combination above, on stdout
+        bool Verbose = true;
+
+        // Seed of the solver's own random sequence, see Solver::m_random. The same seed and config give
+        // bit-identical runs for any thread count.
+        u64 Seed = 1;
+
+        //-- Derived, see Constants::HIGHP
+        constexpr number Scale() const { return static_cast<number>(0.5) / CircleRadius; }
+        constexpr f32    Width() const
+        {
+            return static_cast<f32>(Constants::static_round(Scale() * WorldWidth));
+        }
+        constexpr f32 Height() const
+        {
+            return static_cast<f32>(Constants::static_round(Scale() * WorldHeight));
+        }
+        constexpr vec2 Size() const { return vec2(Width(), Height()); }
+
+        constexpr u32 CirclesPerWidth() const
+        {
+            return static_cast<u32>(Width() / Constants::CircleDiameter) - 1;
+        }
+        constexpr u32 CirclesPerHeight() const
+        {
+            return static_cast<u32>(Height() / Constants::CircleDiameter) - 1;
+        }
+
+        constexpr bool Polydisperse() const { return MaxRadiusScale > 1; }
+        constexpr bool Sparse() const { return SparseGrid && !Polydisperse(); }
+        constexpr bool Jacobi() const { return JacobiCollide && !Polydisperse() && !Sparse(); }
+        constexpr bool Sleeps() const { return Sleeping && !Polydisperse() && !Sparse() && !Jacobi(); }
+        constexpr f32  ListSkin() const
+        {
+            if (Polydisperse() || Sparse() || Jacobi() || !(NeighbourSkin > 0)) return 0.0f;
+            return static_cast<f32>(NeighbourSkin < MaxNeighbourSkin ? NeighbourSkin : MaxNeighbourSkin);
+        }
+        constexpr f32  MaxRadius() const
+        {
+            return static_cast<f32>(Constants::CircleRadius * MaxRadiusScale);
+        }
+
+        // Grid levels needed for the radius range, each level doubling the cell size
+        constexpr u32 RadiusLevels() const
+        {
+            u32    n = 1;
+            number c = Constants::CircleRadius;
+            while (c < Constants::CircleRadius * MaxRadiusScale)
+            {
+                c *= 2;
+                ++n;
+            }
+            return n;
+        }
+
+        // Substep bounds of adaptive updates, at least 2 so that every update sees collisions
+        constexpr u32 SubstepLow() const { return MinSubstep > 2 ? MinSubstep : 2; }
+        constexpr u32 SubstepHigh() const { return MaxSubstep > SubstepLow() ? MaxSubstep : SubstepLow(); }
+
+        constexpr number SubstepDelta() const { return FixedTime / static_cast<number>(Substep); }
+        constexpr vec2   GravityPosition() const
+        {
+            return vec2(0.0f, static_cast<f32>(Scale() * Gravity1d * (SubstepDelta() * SubstepDelta())));
+        }
+    };
+
+    // The default configuration is exactly the compile-time one
+    static_assert(SolverConfig().Width() == Constants::WorldWidth);
+    static_assert(SolverConfig().Height() == Constants::WorldHeight);
+    static_assert(SolverConfig().MaxInstances == Constants::MaxDynamicInstances);
+    static_assert(SolverConfig().CirclesPerWidth() == Constants::CirclesPerWidth);
+    static_assert(SolverConfig().GravityPosition().y == Constants::GravityPosition.y);
+} // namespace PLSC
@@ -0,0 +1,385 @@
+#include "PLSC/Physics/Collider.hpp"
+#include "PLSC/Physics/SDF.hpp"
+#include "PLSC/Physics/Solver.hpp"
+
+#include <cstdio>
+#include <cstring> // memcpy
+#include <new>     // align_val_t
+#include <string>
+#include <typeinfo>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #define PLSC_CHECKPOINT_MMAP 1
+#else
+    #define PLSC_CHECKPOINT_MMAP 0
+#endif
+
+//- Snapshot layout, in native byte order:
+//-     Header
+//-     static colliders, each a Record followed by its parameters
+//-     slot -> id map of every slot, when particles have moved between slots
+//-     generation of every id, once particles have been removed
+//-     padding up to the next page
+//-     ParticleStorage block, byte for byte
+//- The block starts on a page so it can be mapped in place of the storage's own allocation.
+
+namespace PLSC
+{
+    namespace
+    {
+        constexpr u32    Magic     = 0x43534c50; // "PLSC", also rejects the other byte order
+        constexpr u32    Version   = 5;
+        constexpr size_t BlockPage = 4096;
+
+        enum Flags : u32
+        {
+            Radii       = 1,
+            Sleeping    = 2,
+            Ids         = 4,
+            Generations = 8,
+        };
+
+        struct Header
+        {
+            u32 uMagic   = Magic;
+            u32 uVersion = Version;
+            u32 uFlags   = 0;
+
+            // Config the snapshot was taken with, load() requires the same
+            u32 uCapacity = 0, uSubstep = 0;
+            f32 fWidth = 0, fHeight = 0, fMaxRadius = 0;
+            u64 uSeed = 0;
+
+            // State
+            u32 uActive = 0, uUpdates = 0;
+            f32 fGravityX = 0, fGravityY = 0, fLastGravityX = 0, fLastGravityY = 0;
+            u64 uRandomCounter = 0;
+            u32 uSubsteps      = 0; // Of the next update
+            f32 fNextPush      = 0; // See Solver::m_fNextPush
+
+            u32 uStatics     = 0;
+            u32 uReserved    = 0; // Keeps the offsets below 8-byte aligned
+            u64 uBlockOffset = 0, uBlockBytes = 0;
+        };
+
+        enum class Kind : u32
+        {
+            AABB,
+            InverseAABB,
+            Circle,
+            SDF,
+        };
+
+        struct Record
+        {
+            Kind uKind;
+            u32  uBytes; // Parameters following the record
+        };
+
+        u32 layout(const ParticleStorage & s)
+        {
+            return (s.R ? u32(Radii) : 0u) | (s.Rest ? u32(Sleeping) : 0u);
+        }
+
+        static_assert(sizeof(Collider::SDF::Sample) == sizeof(f32) * 3);
+
+        void put(std::string & out, const void * p, const size_t n)
+        {
+            out.append(static_cast<const char *>(p), n);
+        }
+        template <typename T>
+        void put(std::string & out, const T & v)
+        {
+            put(out, &v, sizeof(T));
+        }
+
+        void putRecord(std::string & out, const Kind kind, const std::initializer_list<f32> & params)
+        {
+            put(out, Record {kind, static_cast<u32>(sizeof(f32) * params.size())});
+            for (const f32 x : params) put(out, x);
+        }
+
+        // Bounds checked reads out of the loaded bytes
+        struct Cursor
+        {
+            const u8_t * p;
+            const u8_t * end;
+
+            bool get(void * dst, const size_t n)
+            {
+                if (static_cast<size_t>(end - p) < n) return false;
+                std::memcpy(dst, p, n);
+                p += n;
+                return true;
+            }
+            template <typename T>
+            bool get(T & v)
+            {
+                return get(&v, sizeof(T));
+            }
+        };
+
+        // Parameters of a Record, in the order putRecord wrote them
+        bool mkCollider(const Kind kind, Cursor c, std::shared_ptr<Collider::ICollider> & out)
+        {
+            f32 v[5];
+            switch (kind)
+            {
+                case Kind::AABB:
+                    if (!c.get(v, sizeof(f32) * 4)) return false;
+                    out = std::make_shared<Collider::AABB>(vec2(v[0], v[1]), vec2(v[2], v[3]));
+                    return true;
+                case Kind::InverseAABB:
+                    if (!c.get(v, sizeof(f32) * 4)) return false;
+                    out = std::make_shared<Collider::InverseAABB>(vec2(v[0], v[1]), vec2(v[2], v[3]));
+                    return true;
+                case Kind::Circle:
+                    if (!c.get(v, sizeof(f32) * 3)) return false;
+                    out = std::make_shared<Collider::Circle>(v[0], v[1], v[2]);
+                    return true;
+                case Kind::SDF:
+                {
+                    auto f = std::make_shared<Collider::SDF::Field>();
+                    if (!c.get(v, sizeof(f32) * 3) || !c.get(f->nx) || !c.get(f->ny)) return false;
+                    f->origin = vec2(v[0], v[1]);
+                    f->cell   = v[2];
+                    f->inv    = 1.0f / v[2];
+                    const size_t count = static_cast<size_t>(f->nx) * f->ny;
+                    if (f->nx < 2 || f->ny < 2 || static_cast<size_t>(c.end - c.p) / sizeof(f32) / 3 < count)
+                        return false;
+                    f->samples.resize(count);
+                    c.get(f->samples.data(), sizeof(Collider::SDF::Sample) * count);
+                    out = std::make_shared<Collider::SDF>(std::move(f));
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool writeFile(const char * path, const std::string & head, const void * block, const size_t bytes)
+        {
+            std::FILE * f = std::fopen(path, "wb");
+            if (!f) return false;
+            bool ok = std::fwrite(head.data(), 1, head.size(), f) == head.size()
+                      && std::fwrite(block, 1, bytes, f) == bytes;
+            ok &= std::fclose(f) == 0;
+            if (!ok) std::remove(path);
+            return ok;
+        }
+    } // namespace
+
+    bool Solver::save(const char * const path) const
+    {
+        Header h;
+        h.uFlags         = layout(m_objects) | (m_objects.hasIds() ? u32(Ids) : 0u)
+                         | (m_objects.generations() ? u32(Generations) : 0u);
+        h.uCapacity      = m_objects.capacity();
+        h.uSubstep       = m_config.Substep;
+        h.fWidth         = m_config.Width();
+        h.fHeight        = m_config.Height();
+        h.fMaxRadius     = m_config.MaxRadius();
+        h.uSeed          = m_config.Seed;
+        h.uActive        = m_active;
+        h.uUpdates       = m_updates;
+        h.fGravityX      = m_gravity.x;
+        h.fGravityY      = m_gravity.y;
+        h.fLastGravityX  = m_lastGravity.x;
+        h.fLastGravityY  = m_lastGravity.y;
+        h.uRandomCounter = m_random.counter();
+        h.uSubsteps      = m_uSubsteps;
+        h.fNextPush      = m_fNextPush;
+        h.uStatics       = static_cast<u32>(m_static.m_interfaces.size());
+        h.uBlockBytes    = m_objects.bytes();
+
+        std::string body;
+        for (const auto & c : m_static.m_interfaces)
+        {
+            const std::type_info & type = typeid(*c);
+            if (type == typeid(Collider::AABB))
+            {
+                const auto & a = static_cast<const Collider::AABB &>(*c);
+                putRecord(body, Kind::AABB, {a.C.x, a.C.y, a.extent.x, a.extent.y});
+            }
+            else if (type == typeid(Collider::InverseAABB))
+            {
+                const auto & a = static_cast<const Collider::InverseAABB &>(*c);
+                putRecord(body, Kind::InverseAABB, {a.C.x, a.C.y, a.extent.x, a.extent.y});
+            }
+            else if (type == typeid(Collider::Circle))
+            {
+                const auto & a = static_cast<const Collider::Circle &>(*c);
+                putRecord(body, Kind::Circle, {a.P.x, a.P.y, a.r});
+            }
+            else if (type == typeid(Collider::SDF))
+            {
+                const Collider::SDF::Field & f       = *static_cast<const Collider::SDF &>(*c).field;
+                const size_t                 samples = sizeof(Collider::SDF::Sample) * f.samples.size();
+                put(body, Record {Kind::SDF, static_cast<u32>(sizeof(f32) * 3 + sizeof(u32) * 2 + samples)});
+                put(body, f.origin.x);
+                put(body, f.origin.y);
+                put(body, f.cell);
+                put(body, f.nx);
+                put(body, f.ny);
+                put(body, f.samples.data(), samples);
+            }
+            else
+            {
+                // A user collider could not be recreated by load()
+                return false;
+            }
+        }
+        // Inactive slots too, they hold the ids of the particles added next
+        if (m_objects.hasIds())
+            for (u32 i = 0; i < m_objects.capacity(); ++i) put(body, m_objects.id(i));
+        if (m_objects.generations()) put(body, m_objects.generations(), sizeof(u32) * m_objects.capacity());
+
+        const size_t head = sizeof(Header) + body.size();
+        h.uBlockOffset    = (head + BlockPage - 1) / BlockPage * BlockPage;
+
+        std::string out;
+        out.reserve(h.uBlockOffset);
+        put(out, h);
+        out += body;
+        out.resize(h.uBlockOffset, '\0');
+
+        // Replace the file in one rename, so a solver still mapping the previous snapshot at this path
+        // keeps its pages
+        const std::string tmp = std::string(path) + ".tmp";
+        if (!writeFile(tmp.c_str(), out, m_objects.data(), m_objects.bytes())) return false;
+        return std::rename(tmp.c_str(), path) == 0;
+    }
+
+    bool Solver::load(const char * const path, const bool map)
+    {
+        // Everything up to the block is parsed before the solver is touched, so a failed load leaves it
+        // as it was. The block is either the file mapping itself or a copy of it.
+        std::string           headCopy;
+        const u8_t *          head  = nullptr;
+        void *                block = nullptr;
+        std::function<void()> free;
+        Header                h;
+
+#if !PLSC_CHECKPOINT_MMAP
+        (void) map;
+#else
+        if (map)
+        {
+            const int fd = ::open(path, O_RDONLY);
+            if (fd < 0) return false;
+            struct stat st {};
+            const size_t length = ::fstat(fd, &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+            void *       base   = MAP_FAILED;
+            if (length >= sizeof(Header))
+                base = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (base == MAP_FAILED) return false;
+
+            free = [base, length] { ::munmap(base, length); };
+            std::memcpy(&h, base, sizeof(Header));
+            if (h.uMagic != Magic || h.uVersion != Version || h.uBlockOffset < sizeof(Header)
+                || h.uBlockOffset > length || length - h.uBlockOffset < h.uBlockBytes
+                || h.uBlockOffset % BlockPage)
+            {
+                free();
+                return false;
+            }
+            head  = static_cast<const u8_t *>(base);
+            block = static_cast<u8_t *>(base) + h.uBlockOffset;
+        }
+#endif
+        if (!block)
+        {
+            std::FILE * f = std::fopen(path, "rb");
+            if (!f) return false;
+            const bool ok = std::fread(&h, sizeof(Header), 1, f) == 1 && h.uMagic == Magic
+                            && h.uVersion == Version && h.uBlockOffset >= sizeof(Header)
+                            && h.uBlockBytes == m_objects.bytes();
+            if (ok)
+            {
+                headCopy.resize(h.uBlockOffset);
+                std::memcpy(headCopy.data(), &h, sizeof(Header));
+                block = ::operator new(h.uBlockBytes, std::align_val_t(ParticleStorage::Alignment));
+                free  = [block] { ::operator delete(block, std::align_val_t(ParticleStorage::Alignment)); };
+            }
+            const size_t rest = ok ? h.uBlockOffset - sizeof(Header) : 0;
+            const bool   read = ok && std::fread(headCopy.data() + sizeof(Header), 1, rest, f) == rest
+                              && std::fread(block, 1, h.uBlockBytes, f) == h.uBlockBytes;
+            std::fclose(f);
+            if (!read)
+            {
+                if (free) free();
+                return false;
+            }
+            head = reinterpret_cast<const u8_t *>(headCopy.data());
+        }
+
+        const bool matches = (h.uFlags & ~(u32(Ids) | u32(Generations))) == layout(m_objects)
+                             && h.uCapacity == m_objects.capacity()
+                             && h.uBlockBytes == m_objects.bytes() && h.uSubstep == m_config.Substep
+                             && h.fWidth == m_config.Width() && h.fHeight == m_config.Height()
+                             && h.fMaxRadius == m_config.MaxRadius() && h.uSeed == m_config.Seed
+                             && h.uActive <= m_config.MaxInstances
+                             && (m_config.AdaptiveSubstep ? h.uSubsteps >= m_config.SubstepLow()
+                                                                && h.uSubsteps <= m_config.SubstepHigh()
+                                                          : h.uSubsteps == m_config.Substep);
+
+        Cursor                                            c {head + sizeof(Header), head + h.uBlockOffset};
+        std::vector<std::shared_ptr<Collider::ICollider>> statics;
+        std::vector<u32>                                  ids, generations;
+        bool                                              ok = matches;
+        for (u32 i = 0; ok && i < h.uStatics; ++i)
+        {
+            Record r;
+            ok = c.get(r) && static_cast<size_t>(c.end - c.p) >= r.uBytes;
+            std::shared_ptr<Collider::ICollider> collider;
+            ok = ok && mkCollider(r.uKind, Cursor {c.p, c.p + r.uBytes}, collider);
+            if (ok)
+            {
+                statics.push_back(std::move(collider));
+                c.p += r.uBytes;
+            }
+        }
+        if (ok && (h.uFlags & Ids))
+        {
+            // Must be a permutation of [0, capacity)
+            std::vector<bool> seen(h.uCapacity);
+            ids.resize(h.uCapacity);
+            ok = c.get(ids.data(), sizeof(u32) * h.uCapacity);
+            for (u32 i = 0; ok && i < h.uCapacity; ++i)
+            {
+                ok = ids[i] < h.uCapacity && !seen[ids[i]];
+                if (ok) seen[ids[i]] = true;
+            }
+        }
+        if (ok && (h.uFlags & Generations))
+        {
+            generations.resize(h.uCapacity);
+            ok = c.get(generations.data(), sizeof(u32) * h.uCapacity);
+        }
+        if (!ok)
+        {
+            free();
+            return false;
+        }
+
+        m_objects.adopt(block, std::move(free));
+        m_objects.setIds(ids.empty() ? nullptr : ids.data(), h.uCapacity);
+        m_objects.setGenerations(generations.empty() ? nullptr : generations.data());
+        m_active      = h.uActive;
+        m_updates     = h.uUpdates;
+        m_gravity     = vec2(h.fGravityX, h.fGravityY);
+        m_lastGravity = vec2(h.fLastGravityX, h.fLastGravityY);
+        m_random.seek(h.uRandomCounter);
+        m_uSubsteps = h.uSubsteps;
+        m_fNextPush = h.fNextPush;
+        m_collisionStructure.setSubsteps(m_uSubsteps);
+        m_static.m_interfaces = std::move(statics);
+        init();
+        m_collisionStructure.invalidate();
+        return true;
+    }
+} // namespace PLSC
@@ -0,0 +1,429 @@
+#include "PLSC/Physics/ParticleStorage.hpp"
+
+#include "PLSC/Constants.hpp"
+
+#include <algorithm> // copy_n, max, swap
+#include <cassert>
+#include <cmath>   // fabs
+#include <cstdint> // uintptr_t
+#include <cstring> // memcpy, memset
+#include <new>     // align_val_t
+
+namespace PLSC
+{
+    namespace
+    {
+        inline u32 bits(const f32 f)
+        {
+            u32 u;
+            std::memcpy(&u, &f, sizeof(u));
+            return u;
+        }
+
+        inline f32 value(const u32 u)
+        {
+            f32 f;
+            std::memcpy(&f, &u, sizeof(f));
+            return f;
+        }
+
+        // All ones where b holds, zero elsewhere
+        inline u32 mask(const bool b) { return 0u - static_cast<u32>(b); }
+
+        // Bits of a where mask is set, of b elsewhere
+        inline f32 pick(const u32 mask, const f32 a, const f32 b)
+        {
+            return value((bits(a) & mask) | (bits(b) & ~mask));
+        }
+
+        // ParticleStorage::update with sleeping. Sleeping particles are not integrated. The others count
+        // the substeps they spend below SleepLimit and fall asleep, at rest, after SleepSteps of them.
+        // Only a speed above SleepLimit2 resets the count, so particles jittering around the limit still
+        // settle, but so does drifting SleepLimit away from where the count began, so particles creeping
+        // along a wall keep going. Masks rather than branches, and restrict parameters rather than
+        // members, so the loop vectorizes and costs the same however many sleep.
+        void integrateSleeping(const u32 n, const vec2 & gravity, f32 * __restrict px, f32 * __restrict py,
+                               f32 * __restrict dpx, f32 * __restrict dpy, f32 * __restrict ax,
+                               f32 * __restrict ay, u8_t * __restrict rest)
+        {
+            using namespace Constants;
+            constexpr f32 WakeLimitSq = SleepLimit2 * SleepLimit2;
+
+            const f32 gx = gravity.x;
+            const f32 gy = gravity.y;
+            for (u32 i = 0; i < n; ++i)
+            {
+                const u32 r      = rest[i];
+                const f32 vx     = px[i] - dpx[i];
+                const f32 vy     = py[i] - dpy[i];
+                const f32 v2     = vx * vx + vy * vy;
+                const f32 dx     = px[i] - ax[i];
+                const f32 dy     = py[i] - ay[i];
+                const u32 asleep = mask(r == SleepSteps);
+                const u32 reset  = mask((v2 > WakeLimitSq) | ((r != 0) & (dx * dx + dy * dy > SleepLimitSq)));
+                const u32 calm   = ~reset & mask(v2 < SleepLimitSq);
+                const u32 next   = (r & asleep) | ((r - calm) & ~reset & ~asleep); // calm is -1 or 0
+                const u32 anchor = calm & mask(r == 0);
+                const u32 moves  = mask(next != SleepSteps);
+
+                ax[i]   = pick(anchor, px[i], ax[i]);
+                ay[i]   = pick(anchor, py[i], ay[i]);
+                rest[i] = static_cast<u8_t>(next);
+                dpx[i]  = pick(asleep, dpx[i], px[i]);
+                dpy[i]  = pick(asleep, dpy[i], py[i]);
+                px[i]   = pick(moves, px[i] + (vx + gx), px[i]);
+                py[i]   = pick(moves, py[i] + (vy + gy), py[i]);
+            }
+        }
+    } // namespace
+
+    ParticleStorage::ParticleStorage(const u32 capacity, const bool radii, const bool sleeping) :
+        m_uCapacity(((capacity + Lane - 1) / Lane) * Lane) // Each array starts on a cache line
+    {
+        const size_t n      = static_cast<size_t>(m_uCapacity);
+        const size_t arrays = 4 + (radii ? 1 : 0) + (sleeping ? 2 : 0);
+        m_uBytes            = sizeof(f32) * n * arrays + (sleeping ? n : 0);
+        m_pBlock            = static_cast<f32 *>(::operator new(m_uBytes, std::align_val_t(Alignment)));
+        std::memset(m_pBlock, 0, m_uBytes); // Checkpoints write the whole block, unused slots too
+
+        point(radii, sleeping);
+        if (R)
+            for (size_t i = 0; i < n; ++i) R[i] = Constants::CircleRadius;
+    }
+
+    ParticleStorage::~ParticleStorage() { release(); }
+
+    void ParticleStorage::point(const bool radii, const bool sleeping)
+    {
+        const size_t n      = static_cast<size_t>(m_uCapacity);
+        const size_t arrays = 4 + (radii ? 1 : 0) + (sleeping ? 2 : 0);
+
+        Px  = m_pBlock;
+        Py  = m_pBlock + n;
+        dPx = m_pBlock + n * 2;
+        dPy = m_pBlock + n * 3;
+        if (radii) R = m_pBlock + n * (arrays - (sleeping ? 3 : 1));
+        if (sleeping)
+        {
+            Ax   = m_pBlock + n * (arrays - 2);
+            Ay   = m_pBlock + n * (arrays - 1);
+            Rest = reinterpret_cast<u8_t *>(m_pBlock + n * arrays);
+        }
+    }
+
+    void ParticleStorage::release()
+    {
+        if (m_freeBlock) m_freeBlock();
+        else ::operator delete(m_pBlock, std::align_val_t(Alignment));
+        m_freeBlock = nullptr;
+    }
+
+    void ParticleStorage::adopt(void * const block, std::function<void()> release)
+    {
+        assert(reinterpret_cast<uintptr_t>(block) % Alignment == 0);
+        this->release();
+        m_pBlock   = static_cast<f32 *>(block);
+        m_freeBlock = std::move(release);
+        point(R != nullptr, Rest != nullptr);
+    }
+
+    void ParticleStorage::setIds(const u32 * const ids, const u32 n)
+    {
+        if (!ids)
+        {
+            m_vIds.clear();
+            m_vSlots.clear();
+            return;
+        }
+        m_vIds.resize(m_uCapacity);
+        m_vSlots.resize(m_uCapacity);
+        m_vScratch.resize(m_uCapacity);
+        m_vScratchIds.resize(m_uCapacity);
+        for (u32 i = 0; i < m_uCapacity; ++i) m_vIds[i] = i < n ? ids[i] : i;
+        for (u32 i = 0; i < m_uCapacity; ++i) m_vSlots[m_vIds[i]] = i;
+    }
+
+    void ParticleStorage::update(const u32 n, const vec2 & gravity)
+    {
+        if (Rest)
+        {
+            integrateSleeping(n, gravity, Px, Py, dPx, dPy, Ax, Ay, Rest);
+            return;
+        }
+
+        f32 * const __restrict px  = Px;
+        f32 * const __restrict py  = Py;
+        f32 * const __restrict dpx = dPx;
+        f32 * const __restrict dpy = dPy;
+
+        for (u32 i = 0; i < n; ++i)
+        {
+            const f32 vx = px[i] - dpx[i];
+            dpx[i]       = px[i];
+            px[i] += vx + gravity.x;
+        }
+        for (u32 i = 0; i < n; ++i)
+        {
+            const f32 vy = py[i] - dpy[i];
+            dpy[i]       = py[i];
+            py[i] += vy + gravity.y;
+        }
+    }
+
+    void ParticleStorage::mkIds()
+    {
+        if (!m_vIds.empty()) return;
+        m_vIds.resize(m_uCapacity);
+        m_vSlots.resize(m_uCapacity);
+        m_vScratch.resize(m_uCapacity);
+        m_vScratchIds.resize(m_uCapacity);
+        for (u32 i = 0; i < m_uCapacity; ++i) m_vIds[i] = m_vSlots[i] = i;
+    }
+
+    u32 ParticleStorage::idBound(const u32 n) const
+    {
+        if (m_vIds.empty()) return n;
+        u32 bound = 0;
+        for (u32 i = 0; i < n; ++i) bound = std::max(bound, m_vIds[i] + 1);
+        return bound;
+    }
+
+    void ParticleStorage::retire(const u32 i)
+    {
+        if (m_vGenerations.empty()) m_vGenerations.assign(m_uCapacity, 0);
+        ++m_vGenerations[id(i)];
+    }
+
+    void ParticleStorage::setGenerations(const u32 * const generations)
+    {
+        if (generations) m_vGenerations.assign(generations, generations + m_uCapacity);
+        else
+            m_vGenerations.clear();
+    }
+
+    void ParticleStorage::permute(const u32 * order, const u32 n)
+    {
+        mkIds();
+
+        f32 * const scratch = m_vScratch.data();
+        const auto  gather  = [&](f32 * const a)
+        {
+            if (!a) return;
+            for (u32 i = 0; i < n; ++i) scratch[i] = a[order[i]];
+            std::memcpy(a, scratch, sizeof(f32) * n);
+        };
+        gather(Px);
+        gather(Py);
+        gather(dPx);
+        gather(dPy);
+        gather(R);
+        gather(Ax);
+        gather(Ay);
+
+        u32 * const ids = m_vScratchIds.data();
+        for (u32 i = 0; i < n; ++i) ids[i] = m_vIds[order[i]];
+        std::memcpy(m_vIds.data(), ids, sizeof(u32) * n);
+        for (u32 i = 0; i < n; ++i) m_vSlots[m_vIds[i]] = i;
+
+        if (Rest)
+        {
+            u8_t * const rest = reinterpret_cast<u8_t *>(ids);
+            for (u32 i = 0; i < n; ++i) rest[i] = Rest[order[i]];
+            std::memcpy(Rest, rest, n);
+        }
+    }
+
+    void ParticleStorage::swap(const u32 a, const u32 b)
+    {
+        if (a == b) return;
+        mkIds();
+        const auto exchange = [a, b](f32 * const v)
+        {
+            if (v) std::swap(v[a], v[b]);
+        };
+        exchange(Px);
+        exchange(Py);
+        exchange(dPx);
+        exchange(dPy);
+        exchange(R);
+        exchange(Ax);
+        exchange(Ay);
+        if (Rest) std::swap(Rest[a], Rest[b]);
+
+        std::swap(m_vIds[a], m_vIds[b]);
+        m_vSlots[m_vIds[a]] = a;
+        m_vSlots[m_vIds[b]] = b;
+    }
+
+    void ParticleStorage::wake(const u32 n, const vec2 & min, const vec2 & max)
+    {
+        if (!Rest) return;
+        for (u32 i = 0; i < n; ++i)
+        {
+            if (Px[i] >= min.x && Px[i] <= max.x && Py[i] >= min.y && Py[i] <= max.y) Rest[i] = 0;
+        }
+    }
+
+    void ParticleStorage::wakeAll(const u32 n)
+    {
+        if (Rest) std::memset(Rest, 0, n);
+    }
+
+    u32 ParticleStorage::countAsleep(const u32 n) const
+    {
+        u32 count = 0;
+        if (Rest)
+            for (u32 i = 0; i < n; ++i) count += Rest[i] == Constants::SleepSteps;
+        return count;
+    }
+
+    f32 ParticleStorage::KE(const u32 n) const
+    {
+        // Same as summing Particle::KE, with the mass factored out of the loop
+        f32 sum = 0;
+        if (R)
+        {
+            for (u32 i = 0; i < n; ++i)
+            {
+                const f32 dx = Px[i] - dPx[i];
+                const f32 dy = Py[i] - dPy[i];
+                sum += (R[i] * R[i] * 4.0f) * std::fabs(dx * dx + dy * dy);
+            }
+        }
+        else
+        {
+            for (u32 i = 0; i < n; ++i)
+            {
+                const f32 dx = Px[i] - dPx[i];
+                const f32 dy = Py[i] - dPy[i];
+                sum += std::fabs(dx * dx + dy * dy);
+            }
+        }
+        return Constants::CircleHalfMass * sum;
+    }
+
+    void ParticleStorage::update(const u32 n, const vec2 & gravity, f32 * const __restrict x,
+                                 f32 * const __restrict y, const bool push, f32 & speedSq, f32 & pushSq)
+    {
+        if (Rest)
+        {
+            // Integer maxima as below
+            const f32 p  = push ? 1.0f : 0.0f;
+            u32       v2 = 0, d2 = 0;
+            for (u32 i = 0; i < n; ++i)
+            {
+                const f32 vx = Px[i] - dPx[i];
+                const f32 vy = Py[i] - dPy[i];
+                const f32 dx = (Px[i] - x[i]) * p;
+                const f32 dy = (Py[i] - y[i]) * p;
+                v2           = std::max(v2, bits(vx * vx + vy * vy));
+                d2           = std::max(d2, bits(dx * dx + dy * dy));
+            }
+            speedSq = std::max(speedSq, value(v2));
+            pushSq  = std::max(pushSq, value(d2));
+            integrateSleeping(n, gravity, Px, Py, dPx, dPy, Ax, Ay, Rest);
+            std::copy_n(Px, n, x);
+            std::copy_n(Py, n, y);
+            return;
+        }
+
+        // One pass, as the bandwidth is the cost. The squares are not negative, so they order like
+        // their bits, and integer maxima vectorize where float ones would need -ffast-math.
+        f32 * const __restrict px  = Px;
+        f32 * const __restrict py  = Py;
+        f32 * const __restrict dpx = dPx;
+        f32 * const __restrict dpy = dPy;
+        const f32              p   = push ? 1.0f : 0.0f;
+        u32                    v2 = 0, d2 = 0;
+        for (u32 i = 0; i < n; ++i)
+        {
+            const f32 vx = px[i] - dpx[i];
+            const f32 vy = py[i] - dpy[i];
+            const f32 dx = (px[i] - x[i]) * p;
+            const f32 dy = (py[i] - y[i]) * p;
+            v2           = std::max(v2, bits(vx * vx + vy * vy));
+            d2           = std::max(d2, bits(dx * dx + dy * dy));
+            dpx[i]       = px[i];
+            dpy[i]       = py[i];
+            px[i] += vx + gravity.x;
+            py[i] += vy + gravity.y;
+            x[i] = px[i];
+            y[i] = py[i];
+        }
+        speedSq = std::max(speedSq, value(v2));
+        pushSq  = std::max(pushSq, value(d2));
+    }
+
+    f32 ParticleStorage::update(const u32 n, const vec2 & gravity, const f32 * const __restrict x,
+                                const f32 * const __restrict y)
+    {
+        u32 d2 = 0; // Integer maxima as above
+        if (Rest)
+        {
+            integrateSleeping(n, gravity, Px, Py, dPx, dPy, Ax, Ay, Rest);
+            for (u32 i = 0; i < n; ++i)
+            {
+                const f32 dx = Px[i] - x[i];
+                const f32 dy = Py[i] - y[i];
+                d2           = std::max(d2, bits(dx * dx + dy * dy));
+            }
+            return value(d2);
+        }
+
+        f32 * const __restrict px  = Px;
+        f32 * const __restrict py  = Py;
+        f32 * const __restrict dpx = dPx;
+        f32 * const __restrict dpy = dPy;
+        for (u32 i = 0; i < n; ++i)
+        {
+            const f32 vx = px[i] - dpx[i];
+            const f32 vy = py[i] - dpy[i];
+            dpx[i]       = px[i];
+            dpy[i]       = py[i];
+            px[i] += vx + gravity.x;
+            py[i] += vy + gravity.y;
+            const f32 dx = px[i] - x[i];
+            const f32 dy = py[i] - y[i];
+            d2           = std::max(d2, bits(dx * dx + dy * dy));
+        }
+        return value(d2);
+    }
+
+    void ParticleStorage::scaleVelocity(const u32 n, const f32 k)
+    {
+        for (u32 i = 0; i < n; ++i) dPx[i] = Px[i] - (Px[i] - dPx[i]) * k;
+        for (u32 i = 0; i < n; ++i) dPy[i] = Py[i] - (Py[i] - dPy[i]) * k;
+    }
+
+    u64 ParticleStorage::checksum(const u32 n) const
+    {
+        u64        h    = 0xcbf29ce484222325ull;
+        const auto word = [&h](const u32 w)
+        {
+            for (u32 b = 0; b < 32; b += 8)
+            {
+                h ^= (w >> b) & 0xffu;
+                h *= 0x100000001b3ull;
+            }
+        };
+        const auto bits = [](const f32 f)
+        {
+            u32 w;
+            std::memcpy(&w, &f, sizeof(w));
+            return w;
+        };
+
+        for (u32 i = 0, end = idBound(n); i < end; ++i)
+        {
+            const u32 s = slot(i);
+            if (s >= n) continue;
+            word(bits(Px[s]));
+            word(bits(Py[s]));
+            word(bits(dPx[s]));
+            word(bits(dPy[s]));
+            if (R) word(bits(R[s]));
+            if (Rest) word(Rest[s]);
+        }
+        return h;
+    }
+} // namespace PLSC
@@ -1,44 +1,309 @@
 #include "PLSC/DBG/Profile.hpp"
 
-#include <iostream>
+#if PLSC_PROFILE
 
-#ifdef PLSC_PROFILE
+    #include <algorithm> // min, max
+    #include <atomic>
+    #include <cmath> // ceil
+    #include <cstdio>
+    #include <cstring> // strcmp
+    #include <iostream>
+    #include <mutex>
+    #include <string>
+    #include <vector>
 
 namespace PLSC::DBG::PROFILE
 {
     using namespace std;
     using namespace chrono;
 
+    namespace
+    {
+        static constexpr size_t MaxEvents = 1 << 20; // Trace events kept per thread
+
+        // Histogram buckets: exact below 2^HistBits ticks, then HistHalf buckets per power of two
+        static constexpr u32_t HistBits = 6;
+        static constexpr u32_t HistHalf = 1u << (HistBits - 1);
+        static constexpr u32_t HistSize = (64 - HistBits) * HistHalf + (1u << HistBits);
+
+        inline u32_t bucket(const u64_t ticks)
+        {
+            if (ticks < (u64_t(1) << HistBits)) return static_cast<u32_t>(ticks);
+            u32_t msb = HistBits;
+            while (ticks >> (msb + 1)) ++msb;
+            const u32_t shift = msb - (HistBits - 1);
+            return shift * HistHalf + static_cast<u32_t>(ticks >> shift);
+        }
+
+        // Middle of the ticks counted in bucket i
+        inline double bucketTicks(const u32_t i)
+        {
+            if (i < (1u << HistBits)) return static_cast<double>(i);
+            const u32_t shift = i / HistHalf - 1;
+            const double low  = static_cast<double>(u64_t(i - shift * HistHalf) << shift);
+            return low + static_cast<double>(u64_t(1) << shift) * 0.5;
+        }
+
+        // Only the owning thread writes, so relaxed load and store stand in for an atomic add
+        struct counter_t
+        {
+            atomic<u64_t> ticks {0}, hits {0}, complexity {0}, max {0};
+        };
+
+        struct histogram_t
+        {
+            atomic<u64_t> counts[HistSize];
+            histogram_t()
+            {
+                for (atomic<u64_t> & c : counts) c.store(0, memory_order_relaxed);
+            }
+        };
+
+        struct event_t
+        {
+            u32_t id, complexity;
+            u64_t t0, t1;
+        };
+
+        struct thread_data_t
+        {
+            counter_t             counters[MaxScopes];
+            atomic<histogram_t *> histograms[MaxScopes]; // Allocated by the thread on first use
+            vector<event_t>       events;
+            u32_t                 tid = 0;
+            thread_data_t()
+            {
+                for (atomic<histogram_t *> & h : histograms) h.store(nullptr, memory_order_relaxed);
+            }
+        };
+
+        struct registry_t
+        {
+            mutex                          lock;
+            vector<const profile_data *>   scopes;
+            vector<thread_data_t *>        threads; // Kept after their thread exits
+            vector<thread_data_t *>        unused;  // Left by exited threads, reused by new ones
+            atomic<bool>                   tracing {false};
+            const u64_t                    ticks0 = now();
+            const steady_clock::time_point time0  = steady_clock::now();
+        };
+
+        // Function local so it exists before any profile_data, whatever the initialisation order
+        registry_t & registry()
+        {
+            static registry_t r;
+            return r;
+        }
+
+        // Hands the thread's counters back to the registry when the thread exits
+        struct thread_slot_t
+        {
+            thread_data_t * p = nullptr;
+            ~thread_slot_t()
+            {
+                if (!p) return;
+                registry_t &      r = registry();
+                lock_guard<mutex> g(r.lock);
+                r.unused.push_back(p);
+            }
+        };
+
+        thread_data_t & local()
+        {
+            thread_local thread_slot_t slot;
+            if (!slot.p)
+            {
+                registry_t &      r = registry();
+                lock_guard<mutex> g(r.lock);
+                if (!r.unused.empty())
+                {
+                    slot.p = r.unused.back();
+                    r.unused.pop_back();
+                }
+                else
+                {
+                    slot.p      = new thread_data_t;
+                    slot.p->tid = static_cast<u32_t>(r.threads.size());
+                    r.threads.push_back(slot.p);
+                }
+            }
+            return *slot.p;
+        }
+
+        // Nanoseconds per tick of now()
+        double tickNs()
+        {
+    #if PLSC_PROFILE_TSC
+            const registry_t & r     = registry();
+            const double       ticks = static_cast<double>(now() - r.ticks0);
+            const nanoseconds  t     = duration_cast<nanoseconds>(steady_clock::now() - r.time0);
+            const double       ns    = static_cast<double>(t.count());
+            return ticks > 0.0 ? ns / ticks : 1.0;
+    #else
+            return 1.0;
+    #endif
+        }
+
+        inline void add(atomic<u64_t> & a, const u64_t v)
+        {
+            a.store(a.load(memory_order_relaxed) + v, memory_order_relaxed);
+        }
+
+        u32_t mkId(const profile_data * const pData)
+        {
+            registry_t &      r = registry();
+            lock_guard<mutex> g(r.lock);
+            if (r.scopes.size() >= MaxScopes) return MaxScopes; // Not registered, so never reported
+            r.scopes.push_back(pData);
+            return static_cast<u32_t>(r.scopes.size() - 1);
+        }
+    } // namespace
+
     //-- profile_data
-    profile_data::profile_data(const char * const name) : m_name(name) { g_profile.reg(this); }
+    profile_data::profile_data(const char * const name) : m_name(name), m_id(mkId(this)) { }
+
+    //-- Recording
+    void record(const u32_t id, const u64_t t0, const u64_t t1, const u32_t complexity)
+    {
+        if (id >= MaxScopes) return;
+        thread_data_t & t  = local();
+        counter_t &     c  = t.counters[id];
+        const u64_t     dt = t1 - t0;
+        add(c.ticks, dt);
+        add(c.hits, 1);
+        add(c.complexity, complexity);
+        if (dt > c.max.load(memory_order_relaxed)) c.max.store(dt, memory_order_relaxed);
+
+        histogram_t * h = t.histograms[id].load(memory_order_relaxed);
+        if (!h)
+        {
+            h = new histogram_t;
+            t.histograms[id].store(h, memory_order_release);
+        }
+        add(h->counts[bucket(dt)], 1);
+        if (registry().tracing.load(memory_order_relaxed) && t.events.size() < MaxEvents)
+            t.events.push_back({id, complexity, t0, t1});
+    }
 
-    //-- time_recorder_t
-    time_recorder_t::time_recorder_t(profile_data * const pData) :
-        m_pData(pData), m_complexity(1), m_t(high_resolution_clock::now())
+    void reset()
     {
+        registry_t &      r = registry();
+        lock_guard<mutex> g(r.lock);
+        for (thread_data_t * t : r.threads)
+        {
+            for (counter_t & c : t->counters)
+            {
+                c.ticks.store(0, memory_order_relaxed);
+                c.hits.store(0, memory_order_relaxed);
+                c.complexity.store(0, memory_order_relaxed);
+                c.max.store(0, memory_order_relaxed);
+            }
+            for (atomic<histogram_t *> & p : t->histograms)
+            {
+                histogram_t * h = p.load(memory_order_acquire);
+                if (h)
+                    for (atomic<u64_t> & n : h->counts) n.store(0, memory_order_relaxed);
+            }
+        }
     }
 
-    time_recorder_t::time_recorder_t(profile_data * const pData, const u32_t complexity) :
-        m_pData(pData), m_complexity(complexity), m_t(high_resolution_clock::now())
+    //-- Percentiles
+    namespace
+    {
+        // Merge the histograms of the sites matching name over all threads, registry locked
+        bool summarize(const registry_t & r, const char * const name, percentiles_t & out)
+        {
+            vector<u64_t> counts(HistSize, 0);
+            u64_t         hits = 0, max = 0;
+            for (const profile_data * pdata : r.scopes)
+            {
+                if (strcmp(pdata->m_name, name) != 0) continue;
+                for (const thread_data_t * t : r.threads)
+                {
+                    const counter_t &   c = t->counters[pdata->m_id];
+                    const histogram_t * h = t->histograms[pdata->m_id].load(memory_order_acquire);
+                    max                   = std::max(max, c.max.load(memory_order_relaxed));
+                    if (!h) continue;
+                    for (u32_t i = 0; i < HistSize; ++i)
+                    {
+                        const u64_t n = h->counts[i].load(memory_order_relaxed);
+                        counts[i] += n;
+                        hits += n;
+                    }
+                }
+            }
+            out = percentiles_t();
+            if (hits == 0) return false;
+
+            // Each percentile is the middle of the bucket holding that rank, at most the maximum
+            const double ms       = tickNs() * 1e-6;
+            const double ranks[]  = {0.5, 0.9, 0.99, 0.999};
+            double *     values[] = {&out.p50, &out.p90, &out.p99, &out.p999};
+            u64_t        seen     = 0;
+            u32_t        i        = 0;
+            for (u32_t p = 0; p < 4; ++p)
+            {
+                const u64_t rank = static_cast<u64_t>(std::ceil(ranks[p] * static_cast<double>(hits)));
+                while (seen + counts[i] < rank) seen += counts[i++];
+                *values[p] = std::min(bucketTicks(i), static_cast<double>(max)) * ms;
+            }
+            out.hits = hits;
+            out.max  = static_cast<double>(max) * ms;
+            return true;
+        }
+    } // namespace
+
+    bool percentiles(const char * const name, percentiles_t & out)
     {
+        registry_t &      r = registry();
+        lock_guard<mutex> g(r.lock);
+        return summarize(r, name, out);
     }
 
-    time_recorder_t::~time_recorder_t()
+    //-- Chrome trace
+    void traceStart()
     {
-        m_pData->t_ns += duration_cast<nanoseconds>(high_resolution_clock::now() - m_t).count();
-        m_pData->hits++;
-        m_pData->complexity += m_complexity;
+        registry_t &      r = registry();
+        lock_guard<mutex> g(r.lock);
+        for (thread_data_t * t : r.threads) t->events.clear();
+        r.tracing.store(true, memory_order_relaxed);
     }
 
-    //-- profile_t
-    inline void profile_t::reg(profile_data * const pData)
+    bool traceWrite(const char * const path)
     {
-        std::cout << "PROFILE REGISTER: " << pData->m_name << std::endl;
-        m_pointers.push_back(pData);
+        registry_t &      r = registry();
+        lock_guard<mutex> g(r.lock);
+        r.tracing.store(false, memory_order_relaxed);
+
+        FILE * f = fopen(path, "w");
+        if (!f) return false;
+
+        // Complete events in microseconds from the first one
+        u64_t t0 = ~u64_t(0);
+        for (const thread_data_t * t : r.threads)
+            for (const event_t & e : t->events) t0 = min(t0, e.t0);
+        const double us = tickNs() * 1e-3;
+
+        fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+        bool first = true;
+        for (thread_data_t * t : r.threads)
+        {
+            for (const event_t & e : t->events)
+            {
+                fprintf(f,
+                        "%s\n{\"name\": \"%s\", \"cat\": \"PLSC\", \"ph\": \"X\", \"pid\": 0, \"tid\": %u, "
+                        "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"n\": %u}}",
+                        first ? "" : ",", r.scopes[e.id]->m_name, t->tid, static_cast<double>(e.t0 - t0) * us,
+                        static_cast<double>(e.t1 - e.t0) * us, e.complexity);
+                first = false;
+            }
+            t->events.clear();
+        }
+        fprintf(f, "\n]}\n");
+        return fclose(f) == 0;
     }
 
     //-- output()
-    using namespace std;
     enum output_names
     {
         NAME,
@@ -46,26 +311,39 @@ namespace PLSC::DBG::PROFILE
         AVG_COMPLEXITY,
         TOTAL_MS,
         NS_PER_COMPLEXITY,
+        P50,
+        P99,
+        P999,
+        MAX,
         length
     };
-    static const string suffixes[output_names::length] = {" [", " i,", " c/i]", " ms/i", " ns/c"};
-    static const string prefixes[output_names::length] = {"", "", "", "", ""};
+    static const string suffixes[output_names::length]
+        = {" [", " i,", " c/i]", " ms/i", " ns/c", " p50", " p99", " p99.9", " max ms"};
+    static const string prefixes[output_names::length] = {"", "", "", "", "", "", "", "", ""};
+    static string       ms_string(const double ms)
+    {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%.3f", ms);
+        return buffer;
+    }
     struct output_fmt_t
     {
         string fields[output_names::length];
-        output_fmt_t(const char * name, profile_data data)
+        output_fmt_t(const char * name, const u64_t t_ns, const u64_t hits, const u64_t complexity,
+                     const percentiles_t & p)
         {
-            u64_t  t_ns                             = data.t_ns;
-            u64_t  hits                             = data.hits;
-            u64_t  complexity                       = data.complexity;
             u64_t  avg_complexity                   = complexity / hits;
-            u64_t  ns_per_complexity                = t_ns / complexity;
+            u64_t  ns_per_complexity                = complexity ? t_ns / complexity : 0;
             double t_ms                             = (double) t_ns / (double) 1e6;
             fields[output_names::NAME]              = string(name);
-            fields[output_names::HITS]              = to_string(data.hits);
+            fields[output_names::HITS]              = to_string(hits);
             fields[output_names::AVG_COMPLEXITY]    = to_string(avg_complexity);
             fields[output_names::TOTAL_MS]          = to_string(t_ms / (double) hits);
             fields[output_names::NS_PER_COMPLEXITY] = to_string(ns_per_complexity);
+            fields[output_names::P50]               = ms_string(p.p50);
+            fields[output_names::P99]               = ms_string(p.p99);
+            fields[output_names::P999]              = ms_string(p.p999);
+            fields[output_names::MAX]               = ms_string(p.max);
             for (size_t i(0); i < output_names::length; ++i)
             {
                 fields[i] = prefixes[i] + fields[i] + suffixes[i];
@@ -74,9 +352,28 @@ namespace PLSC::DBG::PROFILE
     };
     void output()
     {
-        /* Construct format objects */
+        registry_t &      r = registry();
+        lock_guard<mutex> g(r.lock);
+        const double      ns = tickNs();
+
+        /* Construct format objects from the sums over threads */
         vector<output_fmt_t> outputs;
-        for (profile_data * pdata : g_profile.m_pointers) { outputs.emplace_back(pdata->m_name, *pdata); }
+        for (const profile_data * pdata : r.scopes)
+        {
+            u64_t ticks = 0, hits = 0, complexity = 0;
+            for (const thread_data_t * t : r.threads)
+            {
+                const counter_t & c = t->counters[pdata->m_id];
+                ticks += c.ticks.load(memory_order_relaxed);
+                hits += c.hits.load(memory_order_relaxed);
+                complexity += c.complexity.load(memory_order_relaxed);
+            }
+            if (hits == 0) continue;
+            percentiles_t p;
+            summarize(r, pdata->m_name, p);
+            outputs.emplace_back(pdata->m_name, static_cast<u64_t>(static_cast<double>(ticks) * ns), hits,
+                                 complexity, p);
+        }
 
         /* Work out paddings */
         u32 longest_fields[output_names::length] = {0};
@@ -103,4 +400,4 @@ namespace PLSC::DBG::PROFILE
         }
     }
 } // namespace PLSC::DBG::PROFILE
-#endif
\ No newline at end of file
+#endif
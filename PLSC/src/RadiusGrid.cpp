@@ -2,10 +2,19 @@
 
 #include "PLSC/Constants.hpp"
 #include "PLSC/DBG/Profile.hpp"
+#include "PLSC/Math/Random.hpp" // mix
+#include "PLSC/Math/Util.hpp"   // rsqrt_fast
 
-#include <cmath>   // FP_FAST_FMAF, fmaf
-#include <cstring> // memset
+#include <algorithm> // min, fill, sort, unique
+#include <cassert>
+#include <cfloat>    // FLT_EPSILON
+#include <chrono>
+#include <cmath>     // FP_FAST_FMAF, fmaf
+#include <cstring>   // memset
 #include <iostream>
+#include <stdexcept> // invalid_argument
+#include <typeinfo>
+#include <utility> // pair
 
 namespace PLSC
 {
@@ -17,64 +26,198 @@ namespace PLSC
     //    {
     //        //        PrintSpatialStats(m_uCollideObjects, m_uCollideAttempt, m_uCollideSuccess);
     //    }
+    RadiusGrid::RadiusGrid(ParticleStorage * objects, const SolverConfig & config) :
+#ifndef PLSC_FIXED_CONFIG
+        XSize(GridSize(config.Width())),
+        YSize(GridSize(config.Height())),
+        NSize(XSize * YSize),
+        NStripes((XSize + StripeCols - 1) / StripeCols),
+#endif
+        m_objects(objects),
+        m_vDynamicLUT(config.Polydisperse() || config.Sparse() ? 0 : NSize + 1, 0),
+        m_vStaticLUT(config.Sparse() ? 0 : NSize + 1, 0),
+        m_vDynamicGrid(config.MaxInstances, 0),
+        m_uSubsteps(config.Substep),
+        m_vAwakeCells(config.Sleeps() ? NSize : 0, 0),
+        m_fMaxRadius(config.MaxRadius()),
+        m_bVerbose(config.Verbose),
+        m_bSparse(config.Sparse()),
+        m_vCellOf(config.Sparse() ? config.MaxInstances : 0, 0),
+        m_fSkin(config.ListSkin()),
+        m_uListWindow(ListWindow(m_fSkin)),
+        m_vListStart(m_fSkin > 0.0f ? config.MaxInstances + 1 : 0, 0),
+        m_vListX(m_fSkin > 0.0f ? config.MaxInstances : 0, 0.0f),
+        m_vListY(m_fSkin > 0.0f ? config.MaxInstances : 0, 0.0f),
+        m_fJacobiRelax(static_cast<f32>(config.JacobiRelaxation)),
+        m_vJacobiX(config.Jacobi() ? config.MaxInstances : 0, 0.0f),
+        m_vJacobiY(config.Jacobi() ? config.MaxInstances : 0, 0.0f),
+        m_vJacobiN(config.Jacobi() ? config.MaxInstances : 0, 0)
+    {
+#ifdef PLSC_FIXED_CONFIG
+        // Every index into the grid assumes the compile-time size, so refuse any other world
+        if (GridSize(config.Width()) != XSize || GridSize(config.Height()) != YSize)
+            throw std::invalid_argument("PLSC_FIXED_CONFIG build needs the world size of Constants::CFG");
+#endif
+        // Requested settings that the chosen grid does not support, see SolverConfig
+        if (m_bVerbose)
+        {
+            if (config.SparseGrid && !config.Sparse()) std::cout << "SparseGrid ignored: polydisperse\n";
+            if (config.JacobiCollide && !config.Jacobi())
+                std::cout << "JacobiCollide ignored: polydisperse or sparse grid\n";
+            if (config.Sleeping && !config.Sleeps())
+                std::cout << "Sleeping ignored: polydisperse, sparse grid or Jacobi\n";
+            if (config.NeighbourSkin > 0 && !(m_fSkin > 0.0f))
+                std::cout << "NeighbourSkin ignored: polydisperse, sparse grid or Jacobi\n";
+        }
+        if (!config.Polydisperse()) return;
+
+        f32 cell = Constants::CircleRadius;
+        for (u32 l = 0; l < config.RadiusLevels(); ++l, cell += cell)
+        {
+            Level level;
+            level.fInvCell = 1.0f / cell;
+            level.XSize    = Constants::static_ceil<id_t>(config.Width() * level.fInvCell) + (BfrSize * 4);
+            level.YSize    = Constants::static_ceil<id_t>(config.Height() * level.fInvCell) + (BfrSize * 4);
+            level.vLUT.assign(level.XSize * level.YSize + 1, 0);
+            m_vLevels.push_back(std::move(level));
+        }
+    }
+
     void RadiusGrid::mkStatic(RadiusGrid::VCollider &v)
     {
         //- Build grid of static colliders:
         //- Run a particle through every corner of the grid tiles, for every collider which
-        //- intersects the particle at the corner, add collider to tiles sharing this corner
+        //- intersects the particle at the corner, add collider to tiles sharing this corner.
+        //- Only the corners inside a collider's bounds are visited, so the cost follows its area.
         using namespace Constants;
 
-        std::vector<std::vector<bool>> bitmaps(NSize, std::vector<bool>(v.size(), false));
+        // Copy the known collider types out of their pointers
+        std::vector<StaticEntry> entries;
+        entries.reserve(v.size());
+        m_vAABBs.clear();
+        m_vInverseAABBs.clear();
+        m_vCircles.clear();
+        m_vSDFs.clear();
+        m_vVirtual.clear();
+        for (const collider_ptr & c : v)
+        {
+            const std::type_info & type = typeid(*c);
+            if (type == typeid(Collider::AABB))
+            {
+                entries.push_back({StaticEntry::AABB, static_cast<u32>(m_vAABBs.size())});
+                m_vAABBs.push_back(static_cast<const Collider::AABB &>(*c));
+            }
+            else if (type == typeid(Collider::InverseAABB))
+            {
+                entries.push_back({StaticEntry::InverseAABB, static_cast<u32>(m_vInverseAABBs.size())});
+                m_vInverseAABBs.push_back(static_cast<const Collider::InverseAABB &>(*c));
+            }
+            else if (type == typeid(Collider::Circle))
+            {
+                entries.push_back({StaticEntry::Circle, static_cast<u32>(m_vCircles.size())});
+                m_vCircles.push_back(static_cast<const Collider::Circle &>(*c));
+            }
+            else if (type == typeid(Collider::SDF))
+            {
+                entries.push_back({StaticEntry::SDF, static_cast<u32>(m_vSDFs.size())});
+                m_vSDFs.push_back(static_cast<const Collider::SDF &>(*c));
+            }
+            else
+            {
+                entries.push_back({StaticEntry::Virtual, static_cast<u32>(m_vVirtual.size())});
+                m_vVirtual.push_back(c);
+            }
+        }
 
-        Particle test_ob;
+        // (cell, collider) pairs of each chunk of colliders, cells ascending per collider. Sparse grids
+        // key cells by their signed coordinates, packed as ChunkTable::key.
+        const u32 nChunks = std::max<u32>(1, std::min<u32>(static_cast<u32>(v.size()), threads() * 4));
+        std::vector<std::vector<std::pair<u64, u32>>> chunks(nChunks);
 
-        for (u32 x = 0; x <= XSize; ++x)
+        const auto rasterize = [&](const u32 chunk)
         {
-            for (u32 y = 0; y <= YSize; ++y)
+            Particle test_ob;
+            test_ob.r = m_fMaxRadius; // Register colliders for the largest particle
+
+            std::vector<u64> cells;
+            const u32        j0 = static_cast<u32>(v.size() * chunk / nChunks);
+            const u32        j1 = static_cast<u32>(v.size() * (chunk + 1) / nChunks);
+            for (u32 j = j0; j < j1; ++j)
             {
-                const f32 fx = static_cast<float>(x) * 0.5f - fBfrSize;
-                const f32 fy = static_cast<float>(y) * 0.5f - fBfrSize;
-                test_ob.P.x  = fx;
-                test_ob.P.y  = fy;
+                // Corner x sits at x * 0.5 - BfrSize. Sparse grids clip to the same corners, so unbounded
+                // colliders stay finite, and key cells by their signed coordinates.
+                vec2 min, max;
+                v[j]->Bounds(test_ob.r, min, max);
+                const auto corner = [](const f32 c, const id_t size)
+                { return static_cast<u32>(clamp(c + fBfrSize2, 0.0f, static_cast<f32>(size))); };
+                const auto key = [this](const id_t x, const id_t y) -> u64
+                {
+                    if (!m_bSparse) return hash(x, y);
+                    const i32 b = static_cast<i32>(BfrSize * 2);
+                    return ChunkTable::key(static_cast<i32>(x) - b, static_cast<i32>(y) - b);
+                };
+                const u32 x0 = corner(std::floor(min.x * 2.0f), XSize);
+                const u32 x1 = corner(std::ceil(max.x * 2.0f), XSize);
+                const u32 y0 = corner(std::floor(min.y * 2.0f), YSize);
+                const u32 y1 = corner(std::ceil(max.y * 2.0f), YSize);
 
-                for (u32 i = 0; i < v.size(); ++i)
+                cells.clear();
+                for (u32 x = x0; x <= x1; ++x)
                 {
-                    if (v[i]->Intersects(&test_ob))
+                    for (u32 y = y0; y <= y1; ++y)
                     {
-                        id_t xmin       = std::max((i32) x - 1, 0);
-                        id_t ymin       = std::max((i32) y - 1, 0);
-                        id_t xmax       = std::min(x + 1, XSize - 1);
-                        id_t ymax       = std::min(y + 1, YSize - 1);
-                        id_t i00        = hash(xmin, ymin); // - -
-                        id_t i01        = hash(xmin, ymax); // - +
-                        id_t i10        = hash(xmax, ymin); // + -
-                        id_t i11        = hash(xmax, ymax); // + +
-                        bitmaps[i00][i] = true;
-                        bitmaps[i01][i] = true;
-                        bitmaps[i10][i] = true;
-                        bitmaps[i11][i] = true;
+                        test_ob.P.x = static_cast<float>(x) * 0.5f - fBfrSize;
+                        test_ob.P.y = static_cast<float>(y) * 0.5f - fBfrSize;
+                        if (!v[j]->Intersects(&test_ob)) continue;
+
+                        const id_t xmin = std::max((i32) x - 1, 0);
+                        const id_t ymin = std::max((i32) y - 1, 0);
+                        const id_t xmax = std::min(x + 1, XSize - 1);
+                        const id_t ymax = std::min(y + 1, YSize - 1);
+                        cells.push_back(key(xmin, ymin)); // - -
+                        cells.push_back(key(xmin, ymax)); // - +
+                        cells.push_back(key(xmax, ymin)); // + -
+                        cells.push_back(key(xmax, ymax)); // + +
                     }
                 }
+                std::sort(cells.begin(), cells.end());
+                cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+                for (const u64 cell : cells) chunks[chunk].emplace_back(cell, j);
             }
+        };
+        if (m_pPool) m_pPool->forEach(nChunks, rasterize);
+        else
+            for (u32 i = 0; i < nChunks; ++i) rasterize(i);
+
+        if (m_bSparse)
+        {
+            mkStaticSparse(chunks, entries);
+            return;
         }
 
+        // Counting sort into the CSR LUT. Chunks hold ascending colliders, so every cell lists its
+        // colliders in registration order.
+        std::fill(m_vStaticLUT.begin(), m_vStaticLUT.end(), 0);
+        for (const auto & chunk : chunks)
+            for (const auto & pair : chunk) ++m_vStaticLUT[pair.first];
+
         u32 count    = 0;
         u32 more_cnt = 0;
         for (u32 i = 0; i < NSize; ++i)
         {
-            m_aStaticLUT[i] = count;
-
-            for (id_t j = 0; j < v.size(); ++j)
-            {
-                if (bitmaps[i][j])
-                {
-                    m_vStaticGrid.push_back(v[j]);
-                    ++count;
-                }
-            }
-            if (count - m_aStaticLUT[i] > 1) ++more_cnt;
+            const u32 n     = m_vStaticLUT[i];
+            m_vStaticLUT[i] = count;
+            count += n;
+            if (n > 1) ++more_cnt;
         }
-        m_aStaticLUT[NSize] = count;
+        m_vStaticLUT[NSize] = count;
+
+        std::vector<u32> cursor(m_vStaticLUT.begin(), m_vStaticLUT.end() - 1);
+        m_vStaticGrid.assign(count, StaticEntry {});
+        for (const auto & chunk : chunks)
+            for (const auto & pair : chunk) m_vStaticGrid[cursor[pair.first]++] = entries[pair.second];
+
+        if (!m_bVerbose) return;
         std::cout << "Static collider grid size: " << m_vStaticGrid.size() << " (cells>1: " << more_cnt
                   << " [" << (long double) more_cnt / (long double) m_vStaticGrid.size() << "])\n";
     }
@@ -143,6 +286,24 @@ namespace PLSC
 #endif
     }
 
+    inline id_t RadiusGrid::stride() const
+    {
+#if RADIUSGRID_ROWCOL_ORDER == 0
+        return XSize;
+#else // Column ordered
+        return YSize;
+#endif
+    }
+
+    inline id_t RadiusGrid::hash(const f32 x, const f32 y, const id_t stride) const
+    {
+#if RADIUSGRID_ROWCOL_ORDER == 0
+        return Iy(y) * stride + Ix(x);
+#else // Column ordered
+        return Ix(x) * stride + Iy(y);
+#endif
+    }
+
     inline void RadiusGrid::reconstruct(const id_t active)
     {
         PROFILE();
@@ -151,102 +312,1177 @@ namespace PLSC
         // but works excellently for smaller numbers of particles, maybe < ~50000 or so.
 
         // Zero out previous indices
-        //        memset(m_aDynamicLUT.data(), 0, sizeof(id_t) * m_aDynamicLUT.size());
-        m_aDynamicLUT.fill(0);
+        //        memset(m_vDynamicLUT.data(), 0, sizeof(id_t) * m_vDynamicLUT.size());
+        std::fill(m_vDynamicLUT.begin(), m_vDynamicLUT.end(), 0);
 
         // Count objects in each cell
-        for (u32 i = 0; i < active; ++i)
+        const f32 * const Px     = m_objects->Px;
+        const f32 * const Py     = m_objects->Py;
+        const id_t        cells  = NSize;
+        const id_t        stride = this->stride();
+        if (m_objects->Rest)
         {
-            const id_t h = hash(m_objects[i]);
-            ++m_aDynamicLUT[h];
+            // Also flag the cells that have to be visited on behalf of a sleeping particle. Through
+            // pointers, as the flags are bytes and their stores could alias any member.
+            std::fill(m_vAwakeCells.begin(), m_vAwakeCells.end(), 0);
+            id_t * const       lut   = m_vDynamicLUT.data();
+            u8_t * const       awake = m_vAwakeCells.data();
+            const u8_t * const rest  = m_objects->Rest;
+            for (u32 i = 0; i < active; ++i)
+            {
+                const id_t h = hash(Px[i], Py[i], stride);
+                ++lut[h];
+                awake[h] |= rest[i] != Constants::SleepSteps;
+            }
+        }
+        else
+        {
+            for (u32 i = 0; i < active; ++i)
+            {
+                const id_t h = hash(Px[i], Py[i], stride);
+                ++m_vDynamicLUT[h];
+            }
         }
 
         // Compute partial sum for cell starts
         id_t sum = 0;
-        for (id_t i = 0; i <= NSize; ++i)
+        for (id_t i = 0; i <= cells; ++i)
         {
-            sum += m_aDynamicLUT[i];
-            m_aDynamicLUT[i] = sum;
+            sum += m_vDynamicLUT[i];
+            m_vDynamicLUT[i] = sum;
         }
 
         // Stage objects into dense grid
         for (id_t i = 0; i < active; ++i)
         {
-            const id_t id   = hash(m_objects[i]);
-            id_t &     cell = m_aDynamicLUT[id];
+            const id_t id   = hash(Px[i], Py[i], stride);
+            id_t &     cell = m_vDynamicLUT[id];
             --cell;
-            m_aDynamicGrid[cell] = i;
+            m_vDynamicGrid[cell] = i;
         }
     }
 
+    inline void RadiusGrid::collideStatic(Particle & ob, const id_t h)
+    {
+        collideStatic(ob, m_vStaticLUT[h], m_vStaticLUT[h + 1]);
+    }
+
+    inline void RadiusGrid::collideStatic(Particle & ob, const id_t begin, const id_t end)
+    {
+        for (id_t i = begin; i < end; ++i)
+        {
+            const StaticEntry & e = m_vStaticGrid[i];
+            switch (e.uType)
+            {
+                case StaticEntry::AABB: m_vAABBs[e.uIndex].CollideFast(&ob); break;
+                case StaticEntry::InverseAABB: m_vInverseAABBs[e.uIndex].CollideFast(&ob); break;
+                case StaticEntry::Circle: m_vCircles[e.uIndex].CollideFast(&ob); break;
+                case StaticEntry::SDF: m_vSDFs[e.uIndex].CollideFast(&ob); break;
+                case StaticEntry::Virtual: m_vVirtual[e.uIndex]->CollideFast(&ob); break;
+            }
+        }
+    }
+
+    inline bool RadiusGrid::collideKinematic(Particle & ob, const id_t h) const
+    {
+        bool hit = false;
+        for (u64 mask = m_vKinematicMask[h], i = 0; mask; mask >>= 1, ++i)
+        {
+            if (!(mask & 1)) continue;
+            const KinematicState & k = m_vKinematic[i];
+            hit |= k.now.Collide(&ob, k.v, k.w);
+        }
+        return hit;
+    }
+
+    inline void RadiusGrid::collideCandidates(Particle & ob, const id_t * ids, const u32 n)
+    {
+        f32 * const Px = m_objects->Px;
+        f32 * const Py = m_objects->Py;
+        for (u32 i = 0; i < n; ++i)
+        {
+            //            ++m_uCollideAttempt;
+            //            m_uCollideSuccess += ob.CollideFast(ob2);
+            ob.CollideFast(Px[ids[i]], Py[ids[i]]);
+        }
+    }
+
+    inline bool RadiusGrid::awakeNear(const id_t h) const
+    {
+        // Any awake particle in the half neighbourhood of collideSubset
+        for (id_t i = 0; i < 3 && h >= YSize * i; ++i)
+        {
+            const id_t c = h - YSize * i;
+            if (m_vAwakeCells[c - 2] | m_vAwakeCells[c - 1] | m_vAwakeCells[c] | m_vAwakeCells[c + 1]
+                | m_vAwakeCells[c + 2])
+                return true;
+        }
+        return false;
+    }
+
+    inline void RadiusGrid::collideSleeper(Particle & ob, const id_t ob_id, const id_t * ids, const u32 n)
+    {
+        // ob sleeps and every candidate is awake, so the candidates take the corrections until one
+        // hits hard enough to wake ob up
+        f32 * const Px    = m_objects->Px;
+        f32 * const Py    = m_objects->Py;
+        bool        awake = !m_objects->asleep(ob_id);
+        for (u32 i = 0; i < n; ++i)
+        {
+            if (awake)
+            {
+                ob.CollideFast(Px[ids[i]], Py[ids[i]]);
+                continue;
+            }
+            Particle other = m_objects->load(ids[i]);
+            if (other.CollideResting(ob.P.x, ob.P.y))
+            {
+                m_objects->wake(ob_id);
+                awake = true;
+            }
+            Px[ids[i]] = other.P.x;
+            Py[ids[i]] = other.P.y;
+        }
+    }
+
+    template <bool Sleeping>
     inline void RadiusGrid::collideSubset(const u32 start, const u32 end)
     {
-        PROFILE_COMPLEXITY(end - start);
         //        m_uCollideObjects += (end - start);
+        f32 * const Px = m_objects->Px;
+        f32 * const Py = m_objects->Py;
         for (u32 grid_id = start; grid_id < end; ++grid_id)
         {
-            const id_t &ob1_id = m_aDynamicGrid[grid_id];
-            Particle &  ob     = m_objects[ob1_id];
+            const id_t &ob1_id = m_vDynamicGrid[grid_id];
+            id_t        h0     = hash(Px[ob1_id], Py[ob1_id]);
 
-            //- Collide static objects
-            id_t h0 = hash(ob);
-            for (id_t i = m_aStaticLUT[h0]; i < m_aStaticLUT[h0 + 1]; ++i)
+            // Sleeping particles skip the static colliders, and their neighbourhood entirely when
+            // nothing in it is awake. Then the rest of the cell sleeps too, as sleepers do not move and
+            // nothing visited before can reach the cell, so it is skipped whole.
+            const bool asleep = Sleeping && m_objects->asleep(ob1_id);
+            if (asleep && !awakeNear(h0) && (m_vKinematicMask.empty() || !m_vKinematicMask[h0]))
             {
-                m_vStaticGrid[i]->CollideFast(&ob);
+                grid_id = std::max(grid_id, std::min(end, m_vDynamicLUT[h0 + 1]) - 1);
+                continue;
             }
 
-            // if (!ob.isAwake()) continue;
-            id_t cell0 = m_aDynamicLUT[h0 - 2]; // std::min(grid_id, m_aDynamicLUT[h0-2]);
-            for (; cell0 < grid_id; ++cell0)
-            {
-                const id_t       ob2_id = m_aDynamicGrid[cell0];
-                Particle * const ob2    = &m_objects[ob2_id];
+            Particle ob = m_objects->load(ob1_id); // Kept local, stored back below
+
+            //- Collide static objects
+            if (!asleep) collideStatic(ob, h0);
+            if (!m_vKinematicMask.empty() && collideKinematic(ob, h0) && asleep) m_objects->wake(ob1_id);
 
-                //                ++m_uCollideAttempt;
-                //                m_uCollideSuccess += ob.CollideFast(ob2);
-                ob.CollideFast(ob2);
+            // With sleeping, pairs of sleeping particles are dropped and awake-vs-sleeping pairs are
+            // resolved apart
+            const auto visit = [&](id_t cell0, const id_t cell1)
+            {
+                for (; cell0 < cell1; ++cell0)
+                {
+                    const id_t id = m_vDynamicGrid[cell0];
 #ifdef COUNT_COLLISION_PAIRS
-                m_dbgPairCounter.add(ob1_id, ob2_id);
+                    m_dbgPairCounter.add(ob1_id, id);
 #endif
-            }
+                    if (Sleeping && m_objects->asleep(id))
+                    {
+                        if (!asleep && ob.CollideResting(Px[id], Py[id])) m_objects->wake(id);
+                        continue;
+                    }
+                    if (asleep) collideSleeper(ob, ob1_id, &id, 1);
+                    else
+                        ob.CollideFast(Px[id], Py[id]);
+                }
+            };
 
+            visit(m_vDynamicLUT[h0 - 2], grid_id); // h(x, y-2) up to self
             for (id_t i = 0; i < 2; ++i)
             {
 #if RADIUSGRID_ROWCOL_ORDER == 0
                 if (h0 < XSize) break;
-                h0 -= XSize;                        // h(x+i, y)
-#else                                               // Column ordered
+                h0 -= XSize;                                       // h(x+i, y)
+#else                                                              // Column ordered
                 if (h0 < YSize) break;
                 h0 -= YSize;
 #endif
-                cell0      = m_aDynamicLUT[h0 - 2]; // h(x+i, y-2)
-                id_t cell1 = m_aDynamicLUT[h0 + 3]; // std::min(grid_id, m_aDynamicLUT[h0+3]); // h(x+i, y+2)
+                visit(m_vDynamicLUT[h0 - 2], m_vDynamicLUT[h0 + 3]); // h(x+i, y-2) .. h(x+i, y+2)
+            }
+
+            m_objects->store(ob1_id, ob);
+        }
+    }
+
+    inline bool RadiusGrid::listsValid(const u32 active) const
+    {
+        // Every pair that can touch is listed until some particle has moved half the skin
+        if (active != m_uListActive) return false;
+        const f32 limit = (m_fSkin * 0.5f) * (m_fSkin * 0.5f);
+        if (m_fListMovedSq >= 0.0f) return m_fListMovedSq <= limit;
+
+        const f32 * const Px    = m_objects->Px;
+        const f32 * const Py    = m_objects->Py;
+        f32               maxSq = 0.0f;
+        for (u32 i = 0; i < active; ++i)
+        {
+            const f32 dx = Px[i] - m_vListX[i];
+            const f32 dy = Py[i] - m_vListY[i];
+            maxSq        = std::max(maxSq, dx * dx + dy * dy);
+        }
+        return maxSq <= limit;
+    }
+
+    inline void RadiusGrid::buildLists(const u32 active)
+    {
+        PROFILE();
+        // Same half neighbourhood as collideSubset, widened to cover the skin. Lists are stored by
+        // grid position, so the stripes of collideStripes still partition them.
+        const f32 * const Px    = m_objects->Px;
+        const f32 * const Py    = m_objects->Py;
+        const f32         reach = (Constants::CircleDiameter + m_fSkin) * (Constants::CircleDiameter + m_fSkin);
+        const id_t        w     = m_uListWindow;
+        const id_t        ys    = YSize; // Read once, see stride()
+
+        m_vLists.clear();
+        for (u32 grid_id = 0; grid_id < active; ++grid_id)
+        {
+            m_vListStart[grid_id] = static_cast<id_t>(m_vLists.size());
+
+            const id_t ob1_id = m_vDynamicGrid[grid_id];
+            const f32  x      = Px[ob1_id];
+            const f32  y      = Py[ob1_id];
+            const auto add    = [&](id_t cell0, const id_t cell1)
+            {
                 for (; cell0 < cell1; ++cell0)
                 {
-                    const id_t       ob2_id = m_aDynamicGrid[cell0];
-                    Particle * const ob2    = &m_objects[ob2_id];
-                    //                    ++m_uCollideAttempt;
-                    //                    m_uCollideSuccess += ob.CollideFast(ob2);
-                    ob.CollideFast(ob2);
-#ifdef COUNT_COLLISION_PAIRS
-                    m_dbgPairCounter.add(ob1_id, ob2_id);
+                    const id_t id = m_vDynamicGrid[cell0];
+                    const f32  dx = x - Px[id];
+                    const f32  dy = y - Py[id];
+                    if (dx * dx + dy * dy < reach) m_vLists.push_back(id);
+                }
+            };
+
+            id_t h0 = hash(x, y, ys);
+            add(m_vDynamicLUT[h0 - w], grid_id);
+            for (id_t i = 0; i < w && h0 >= ys; ++i)
+            {
+                h0 -= ys;
+                add(m_vDynamicLUT[h0 - w], m_vDynamicLUT[h0 + w + 1]);
+            }
+        }
+        m_vListStart[active] = static_cast<id_t>(m_vLists.size());
+
+        std::copy(Px, Px + active, m_vListX.begin());
+        std::copy(Py, Py + active, m_vListY.begin());
+        m_uListActive      = active;
+        m_listStats.uPairs = m_vLists.size();
+    }
+
+    template <bool Sleeping>
+    inline void RadiusGrid::collideLists(const u32 start, const u32 end)
+    {
+        for (u32 grid_id = start; grid_id < end; ++grid_id)
+        {
+            const id_t  ob1_id = m_vDynamicGrid[grid_id];
+            const bool  asleep = Sleeping && m_objects->asleep(ob1_id);
+            const id_t *ids    = m_vLists.data() + m_vListStart[grid_id];
+            const u32   n      = m_vListStart[grid_id + 1] - m_vListStart[grid_id];
+            Particle    ob     = m_objects->load(ob1_id);
+
+            //- Collide static objects
+            const id_t h0 = hash(ob);
+            if (!asleep) collideStatic(ob, h0);
+            if (!m_vKinematicMask.empty() && collideKinematic(ob, h0) && asleep) m_objects->wake(ob1_id);
+
+            if (!Sleeping) collideCandidates(ob, ids, n);
+            else
+            {
+                // Filtered as in collideSubset
+                for (u32 j = 0; j < n; ++j)
+                {
+                    const id_t id = ids[j];
+                    if (m_objects->asleep(id))
+                    {
+                        if (!asleep && ob.CollideResting(m_objects->Px[id], m_objects->Py[id]))
+                            m_objects->wake(id);
+                        continue;
+                    }
+                    if (asleep) collideSleeper(ob, ob1_id, &id, 1);
+                    else
+                        ob.CollideFast(m_objects->Px[id], m_objects->Py[id]);
+                }
+            }
+
+            m_objects->store(ob1_id, ob);
+        }
+    }
+
+    inline void RadiusGrid::collideRange(const u32 start, const u32 end)
+    {
+        const bool sleeping = m_objects->Rest != nullptr;
+        if (!m_vListStart.empty())
+        {
+            if (sleeping) collideLists<true>(start, end);
+            else
+                collideLists<false>(start, end);
+        }
+        else if (sleeping)
+            collideSubset<true>(start, end);
+        else
+            collideSubset<false>(start, end);
+    }
+
+    inline void RadiusGrid::collideStripes()
+    {
+        // Stripes are processed serially internally, and even stripes strictly before odd ones.
+        // Same-phase stripes are disjoint, so the result never depends on the thread count.
+        const auto stripe = [this](const id_t s)
+        {
+            PROFILE_NAMED("collideStripe");
+            const id_t x0 = s * StripeCols;
+            const id_t x1 = std::min(x0 + StripeCols, XSize);
+            collideRange(m_vDynamicLUT[x0 * YSize], m_vDynamicLUT[x1 * YSize]);
+        };
+
+        for (id_t phase = 0; phase < 2; ++phase)
+        {
+            const id_t n = (NStripes - phase + 1) / 2;
+            if (m_pPool) m_pPool->forEach(n, [&](const u32 i) { stripe(i * 2 + phase); });
+            else
+                for (id_t i = 0; i < n; ++i) stripe(i * 2 + phase);
+        }
+    }
+
+    inline void RadiusGrid::collide(const u32 active)
+    {
+        PROFILE_COMPLEXITY(active);
+        if (!m_vJacobiN.empty())
+        {
+            collideJacobi(active);
+            return;
+        }
+#if RADIUSGRID_STRIPES
+        (void) active;
+        collideStripes();
+#else
+        collideRange(0, active);
 #endif
+    }
+
+    //-- Jacobi
+    inline void RadiusGrid::accumulateJacobi(const u32 start, const u32 end)
+    {
+        // Positions are only read, so every range can run at once. Each particle visits its whole
+        // neighbourhood rather than the half of collideSubset, as it only moves itself.
+        using namespace Constants;
+        const f32 * const Px = m_objects->Px;
+        const f32 * const Py = m_objects->Py;
+        for (u32 grid_id = start; grid_id < end; ++grid_id)
+        {
+            const id_t ob_id = m_vDynamicGrid[grid_id];
+            const f32  x     = Px[ob_id];
+            const f32  y     = Py[ob_id];
+            const id_t ix    = Ix(x);
+            const id_t iy    = Iy(y);
+            const id_t x1    = std::min(ix + 2, XSize - 1);
+
+            f32  sx = 0, sy = 0;
+            id_t n  = 0;
+            for (id_t cx = ix >= 2 ? ix - 2 : 0; cx <= x1; ++cx)
+            {
+                const id_t h = hash(cx, iy);
+                for (id_t cell = m_vDynamicLUT[h - 2]; cell < m_vDynamicLUT[h + 3]; ++cell)
+                {
+                    const id_t id = m_vDynamicGrid[cell];
+                    const f32  dx = x - Px[id];
+                    const f32  dy = y - Py[id];
+                    const f32  d2 = dx * dx + dy * dy;
+                    if (d2 >= CircleDiameterSq || id == ob_id) continue;
+                    // As Particle::CollideFast
+                    const f32 k = ResponseCoef * (1.0f - rsqrt_fast(d2 > FLT_EPSILON ? d2 : CircleRadius));
+                    sx -= dx * k;
+                    sy -= dy * k;
+                    ++n;
+                }
+            }
+            m_vJacobiX[ob_id] = sx;
+            m_vJacobiY[ob_id] = sy;
+            m_vJacobiN[ob_id] = n;
+        }
+    }
+
+    inline void RadiusGrid::applyJacobi(const u32 start, const u32 end)
+    {
+        // Static and kinematic colliders act on the averaged positions, so walls stay hard
+        for (u32 i = start; i < end; ++i)
+        {
+            Particle ob = m_objects->load(i);
+            if (m_vJacobiN[i])
+            {
+                const f32 k = m_fJacobiRelax / static_cast<f32>(m_vJacobiN[i]);
+                ob.P += vec2(m_vJacobiX[i] * k, m_vJacobiY[i] * k);
+            }
+            const id_t h0 = hash(ob);
+            collideStatic(ob, h0);
+            if (!m_vKinematicMask.empty()) collideKinematic(ob, h0);
+            m_objects->store(i, ob);
+        }
+    }
+
+    inline void RadiusGrid::collideJacobi(const u32 active)
+    {
+        // Both passes are split into more tasks than threads, so uneven stripes still balance
+        constexpr u32 Block  = 4096;
+        const auto    stripe = [this](const id_t s)
+        {
+            const id_t x0 = s * StripeCols;
+            const id_t x1 = std::min(x0 + StripeCols, XSize);
+            accumulateJacobi(m_vDynamicLUT[x0 * YSize], m_vDynamicLUT[x1 * YSize]);
+        };
+        const auto block = [this, active](const u32 b)
+        { applyJacobi(b * Block, std::min(b * Block + Block, active)); };
+
+        const u32 blocks = (active + Block - 1) / Block;
+        if (m_pPool)
+        {
+            m_pPool->forEach(NStripes, stripe);
+            m_pPool->forEach(blocks, block);
+        }
+        else
+        {
+            accumulateJacobi(0, active);
+            applyJacobi(0, active);
+        }
+    }
+
+    //-- Polydisperse
+    inline id_t RadiusGrid::Level::hash(const f32 x, const f32 y) const
+    {
+        // Large particles can push small ones far past the walls, so stay inside the buffer
+        const f32  maxX = static_cast<f32>(XSize - BfrSize);
+        const f32  maxY = static_cast<f32>(YSize - BfrSize);
+        const id_t ix   = static_cast<id_t>(clamp(x * fInvCell + fBfrSize2, fBfrSize, maxX));
+        const id_t iy   = static_cast<id_t>(clamp(y * fInvCell + fBfrSize2, fBfrSize, maxY));
+        return ix * YSize + iy;
+    }
+
+    inline u32 RadiusGrid::levelOf(const f32 r) const
+    {
+        u32 l    = 0;
+        f32 cell = Constants::CircleRadius;
+        while (r > cell && l + 1 < m_vLevels.size())
+        {
+            cell += cell;
+            ++l;
+        }
+        return l;
+    }
+
+    inline void RadiusGrid::reconstructLevels(const u32 active)
+    {
+        PROFILE();
+        // Same counting sort as reconstruct, once per level, with the levels laid out back to back
+        const f32 * const Px = m_objects->Px;
+        const f32 * const Py = m_objects->Py;
+        const f32 * const R  = m_objects->R;
+
+        for (Level & level : m_vLevels)
+        {
+            std::fill(level.vLUT.begin(), level.vLUT.end(), 0);
+            level.uCount = 0;
+        }
+
+        for (u32 i = 0; i < active; ++i)
+        {
+            Level & level = m_vLevels[levelOf(R[i])];
+            ++level.vLUT[level.hash(Px[i], Py[i])];
+            ++level.uCount;
+        }
+
+        id_t sum = 0;
+        for (Level & level : m_vLevels)
+        {
+            level.uStart = sum;
+            for (id_t & cell : level.vLUT)
+            {
+                sum += cell;
+                cell = sum;
+            }
+        }
+
+        for (id_t i = 0; i < active; ++i)
+        {
+            Level & level = m_vLevels[levelOf(R[i])];
+            id_t &  cell  = level.vLUT[level.hash(Px[i], Py[i])];
+            --cell;
+            m_vDynamicGrid[cell] = i;
+        }
+    }
+
+    inline void RadiusGrid::collidePolyCandidates(Particle & ob, const id_t * ids, const u32 n)
+    {
+        f32 * const       Px = m_objects->Px;
+        f32 * const       Py = m_objects->Py;
+        const f32 * const R  = m_objects->R;
+        for (u32 i = 0; i < n; ++i) { ob.CollidePoly(Px[ids[i]], Py[ids[i]], R[ids[i]]); }
+    }
+
+    inline void RadiusGrid::collideLevel(const u32 a, const u32 start, const u32 end)
+    {
+        const Level & la = m_vLevels[a];
+        for (id_t grid_id = start; grid_id < end; ++grid_id)
+        {
+            const id_t ob1_id = m_vDynamicGrid[grid_id];
+            Particle   ob     = m_objects->load(ob1_id);
+
+            //- Collide static objects, level 0 has the cells of the static grid
+            const id_t hs = m_vLevels[0].hash(ob.P.x, ob.P.y);
+            collideStatic(ob, hs);
+            if (!m_vKinematicMask.empty()) collideKinematic(ob, hs);
+
+            // Collisions earlier in the pass may have moved ob out of the cell it was placed in
+            const auto visit = [&](const id_t cell0, const id_t cell1)
+            {
+                if (cell0 >= cell1) return;
+                collidePolyCandidates(ob, m_vDynamicGrid.data() + cell0, cell1 - cell0);
+            };
+
+            id_t h0 = la.hash(ob.P.x, ob.P.y);
+            visit(la.vLUT[h0 - 2], grid_id);
+            for (id_t i = 0; i < 2; ++i)
+            {
+                if (h0 < la.YSize) break;
+                h0 -= la.YSize;
+                visit(la.vLUT[h0 - 2], la.vLUT[h0 + 3]);
+            }
+
+            for (u32 b = a + 1; b < m_vLevels.size(); ++b)
+            {
+                const Level & lb = m_vLevels[b];
+                if (!lb.uCount) continue;
+                id_t h = lb.hash(ob.P.x, ob.P.y) - lb.YSize * 2;
+                for (id_t i = 0; i < 5; ++i, h += lb.YSize) { visit(lb.vLUT[h - 2], lb.vLUT[h + 3]); }
+            }
+
+            m_objects->store(ob1_id, ob);
+        }
+    }
+
+    inline void RadiusGrid::collideLevels(const u32 active)
+    {
+        PROFILE_COMPLEXITY(active);
+        (void) active; // Without PLSC_PROFILE
+        // Same-level pairs use the half neighbourhood of collideSubset. Pairs across levels are tested
+        // once, by the smaller particle against the full neighbourhood of the coarser level; a contact
+        // there is at most 1.5 coarse cells away, so the +-2 cell window still suffices.
+        //
+        // Level by level, each in stripes of StripeCols columns of the coarsest level as in
+        // collideStripes. A particle moves no other more than 3 coarsest columns away, so same-phase
+        // stripes stay disjoint and the result never depends on the thread count.
+        const u32  levels   = static_cast<u32>(m_vLevels.size());
+        const id_t nStripes = (m_vLevels.back().XSize + StripeCols - 1) / StripeCols;
+        for (u32 a = 0; a < levels; ++a)
+        {
+            const Level & la = m_vLevels[a];
+            if (!la.uCount) continue;
+
+            // First column of la inside column c of the coarsest level, both offset by fBfrSize2 cells
+            const id_t k      = 1u << (levels - 1 - a);
+            const id_t shift  = BfrSize * 2 * (k - 1);
+            const auto column = [&](const id_t c)
+            { return std::min(c * k > shift ? c * k - shift : 0, la.XSize); };
+            const auto stripe = [&](const id_t s)
+            {
+                PROFILE_NAMED("collideLevelStripe");
+                const id_t x0 = column(s * StripeCols);
+                const id_t x1 = column((s + 1) * StripeCols);
+                collideLevel(a, la.vLUT[x0 * la.YSize], la.vLUT[x1 * la.YSize]);
+            };
+
+            for (id_t phase = 0; phase < 2; ++phase)
+            {
+                const id_t n = (nStripes - phase + 1) / 2;
+                if (m_pPool) m_pPool->forEach(n, [&](const u32 i) { stripe(i * 2 + phase); });
+                else
+                    for (id_t i = 0; i < n; ++i) stripe(i * 2 + phase);
+            }
+        }
+    }
+
+    //-- Sparse grid
+    inline u64 RadiusGrid::ChunkTable::key(const i32 cx, const i32 cy)
+    {
+        return (static_cast<u64>(static_cast<u32>(cx)) << 32) | static_cast<u32>(cy);
+    }
+
+    inline id_t RadiusGrid::ChunkTable::find(const u64 key) const
+    {
+        if (vKeys.empty()) return NoChunk;
+        const size_t mask = vKeys.size() - 1;
+        for (size_t i = Random::mix(key) & mask;; i = (i + 1) & mask)
+        {
+            if (vIndex[i] == NoChunk || vKeys[i] == key) return vIndex[i];
+        }
+    }
+
+    inline void RadiusGrid::ChunkTable::insert(const u64 key, const id_t index)
+    {
+        const size_t mask = vKeys.size() - 1;
+        size_t       i    = Random::mix(key) & mask;
+        while (vIndex[i] != NoChunk) i = (i + 1) & mask;
+        vKeys[i]  = key;
+        vIndex[i] = index;
+    }
+
+    void RadiusGrid::ChunkTable::clear(const size_t capacity)
+    {
+        // At most half full
+        size_t size = 16;
+        while (size < capacity * 2) size *= 2;
+        vKeys.assign(size, 0);
+        vIndex.assign(size, NoChunk);
+    }
+
+    id_t RadiusGrid::mkChunk(const i32 cx, const i32 cy)
+    {
+        const id_t i = static_cast<id_t>(m_vChunks.size());
+        Chunk      c;
+        c.cx      = cx;
+        c.cy      = cy;
+        c.uStatic = m_staticTable.find(ChunkTable::key(cx, cy));
+        m_vChunks.push_back(c);
+        if (m_vChunks.size() * 2 > m_chunkTable.vKeys.size())
+        {
+            m_chunkTable.clear(m_vChunks.size());
+            for (id_t j = 0; j < m_vChunks.size(); ++j)
+                m_chunkTable.insert(ChunkTable::key(m_vChunks[j].cx, m_vChunks[j].cy), j);
+        }
+        else
+            m_chunkTable.insert(ChunkTable::key(cx, cy), i);
+        return i;
+    }
+
+    void RadiusGrid::mkStaticSparse(const std::vector<std::vector<std::pair<u64, u32>>> & chunks,
+                                    const std::vector<StaticEntry> &                     entries)
+    {
+        // Same counting sort as the dense LUT, over the chunks that some collider reaches
+        const auto split = [](const u64 cell, u64 & chunk, id_t & local)
+        {
+            const i32 x = static_cast<i32>(static_cast<u32>(cell >> 32));
+            const i32 y = static_cast<i32>(static_cast<u32>(cell));
+            chunk       = ChunkTable::key(x >> ChunkBits, y >> ChunkBits);
+            local       = static_cast<id_t>(((x & (ChunkSize - 1)) << ChunkBits) | (y & (ChunkSize - 1)));
+        };
+
+        m_vStaticChunks.clear();
+        m_staticTable.clear(0);
+        std::vector<std::pair<id_t, id_t>> placed; // (static chunk, cell) of every pair
+        for (const auto & chunk : chunks)
+        {
+            for (const auto & pair : chunk)
+            {
+                u64  key;
+                id_t local;
+                split(pair.first, key, local);
+                id_t c = m_staticTable.find(key);
+                if (c == NoChunk)
+                {
+                    c = static_cast<id_t>(m_vStaticChunks.size());
+                    m_vStaticChunks.emplace_back();
+                    if (m_vStaticChunks.size() * 2 > m_staticTable.vKeys.size())
+                    {
+                        // Keys are only kept in the table, so collect them before growing it
+                        std::vector<std::pair<u64, id_t>> keys;
+                        for (size_t i = 0; i < m_staticTable.vKeys.size(); ++i)
+                            if (m_staticTable.vIndex[i] != NoChunk)
+                                keys.emplace_back(m_staticTable.vKeys[i], m_staticTable.vIndex[i]);
+                        m_staticTable.clear(m_vStaticChunks.size());
+                        for (const auto & k : keys) m_staticTable.insert(k.first, k.second);
+                    }
+                    m_staticTable.insert(key, c);
+                }
+                ++m_vStaticChunks[c].aLUT[local];
+                placed.emplace_back(c, local);
+            }
+        }
+
+        u32 count = 0;
+        for (StaticChunk & c : m_vStaticChunks)
+        {
+            for (id_t i = 0; i < ChunkCells; ++i)
+            {
+                const id_t n = c.aLUT[i];
+                c.aLUT[i]    = count;
+                count += n;
+            }
+            c.aLUT[ChunkCells] = count;
+        }
+
+        m_vStaticGrid.assign(count, StaticEntry {});
+        size_t p = 0;
+        for (const auto & chunk : chunks)
+            for (const auto & pair : chunk)
+            {
+                const auto [c, local]                               = placed[p++];
+                m_vStaticGrid[m_vStaticChunks[c].aLUT[local]++] = entries[pair.second];
+            }
+        // The increments moved every start to the next cell's
+        for (StaticChunk & c : m_vStaticChunks)
+        {
+            for (id_t i = ChunkCells; i-- > 0;) c.aLUT[i + 1] = c.aLUT[i];
+        }
+        count = 0;
+        for (StaticChunk & c : m_vStaticChunks)
+        {
+            c.aLUT[0] = count;
+            count     = c.aLUT[ChunkCells];
+        }
+
+        // Dynamic chunks made before this look their static chunk up again
+        for (Chunk & c : m_vChunks) c.uStatic = m_staticTable.find(ChunkTable::key(c.cx, c.cy));
+
+        if (!m_bVerbose) return;
+        std::cout << "Static collider grid size: " << m_vStaticGrid.size() << " in " << m_vStaticChunks.size()
+                  << " chunks\n";
+    }
+
+    inline void RadiusGrid::reconstructSparse(const u32 active)
+    {
+        PROFILE();
+        // Clear the chunks that held particles. Every IdleRebuilds rebuilds, free the ones that have
+        // been empty since the last sweep; chunks only move then, when nothing refers to them.
+        for (const id_t c : m_vActiveChunks)
+        {
+            m_vChunks[c].aLUT.fill(0);
+            m_vChunks[c].uCount = 0;
+        }
+        if (++m_uChunkRebuilds % IdleRebuilds == 0)
+        {
+            const auto idle = [this](const Chunk & c) { return m_uChunkRebuilds - c.uUsed > IdleRebuilds; };
+            m_vChunks.erase(std::remove_if(m_vChunks.begin(), m_vChunks.end(), idle), m_vChunks.end());
+            m_chunkTable.clear(m_vChunks.size());
+            for (id_t j = 0; j < m_vChunks.size(); ++j)
+                m_chunkTable.insert(ChunkTable::key(m_vChunks[j].cx, m_vChunks[j].cy), j);
+        }
+        m_vActiveChunks.clear();
+
+        // Count particles per cell. Cells are floor(2 * p), chunks the upper bits of those.
+        // Neighbouring particles mostly share a chunk, so the last one found is tried first
+        const f32 * const Px   = m_objects->Px;
+        const f32 * const Py   = m_objects->Py;
+        u64               last = ~u64(0);
+        id_t              c    = NoChunk;
+        for (u32 i = 0; i < active; ++i)
+        {
+            const i32 x   = static_cast<i32>(std::floor(Px[i] * 2.0f));
+            const i32 y   = static_cast<i32>(std::floor(Py[i] * 2.0f));
+            const u64 key = ChunkTable::key(x >> ChunkBits, y >> ChunkBits);
+            if (c == NoChunk || key != last)
+            {
+                c = m_chunkTable.find(key);
+                if (c == NoChunk) c = mkChunk(x >> ChunkBits, y >> ChunkBits);
+                last = key;
+            }
+
+            Chunk &    chunk = m_vChunks[c];
+            const id_t local = static_cast<id_t>(((x & (ChunkSize - 1)) << ChunkBits)
+                                                 | (y & (ChunkSize - 1)));
+            if (!chunk.uCount++)
+            {
+                chunk.uUsed = m_uChunkRebuilds;
+                m_vActiveChunks.push_back(c);
+            }
+            ++chunk.aLUT[local];
+            m_vCellOf[i] = (c << (2 * ChunkBits)) | local;
+        }
+
+        // Lay the chunks out by column, so every column of chunks is a contiguous run of the grid
+        std::sort(m_vActiveChunks.begin(), m_vActiveChunks.end(),
+                  [this](const id_t a, const id_t b)
+                  {
+                      const Chunk &ca = m_vChunks[a], &cb = m_vChunks[b];
+                      return ca.cx != cb.cx ? ca.cx < cb.cx : ca.cy < cb.cy;
+                  });
+        id_t sum = 0;
+        for (const id_t c : m_vActiveChunks)
+        {
+            Chunk & chunk = m_vChunks[c];
+            for (id_t i = 0; i < ChunkCells; ++i)
+            {
+                sum += chunk.aLUT[i];
+                chunk.aLUT[i] = sum;
+            }
+            chunk.aLUT[ChunkCells] = sum;
+        }
+
+        for (id_t i = 0; i < active; ++i)
+        {
+            const u32 cell       = m_vCellOf[i];
+            id_t &    start      = m_vChunks[cell >> (2 * ChunkBits)].aLUT[cell & (ChunkCells - 1)];
+            m_vDynamicGrid[--start] = i;
+        }
+
+        // Neighbouring chunks and the columns of chunks, for collideSparse
+        m_vChunkColumns[0].clear();
+        m_vChunkColumns[1].clear();
+        for (u32 i = 0; i < m_vActiveChunks.size(); ++i)
+        {
+            Chunk & chunk = m_vChunks[m_vActiveChunks[i]];
+            for (i32 dx = -1, n = 0; dx <= 0; ++dx)
+                for (i32 dy = -1; dy <= 1; ++dy, ++n)
+                    chunk.aNear[n] = m_chunkTable.find(ChunkTable::key(chunk.cx + dx, chunk.cy + dy));
+
+            if (i == 0 || m_vChunks[m_vActiveChunks[i - 1]].cx != chunk.cx)
+            {
+                std::vector<u32> & columns = m_vChunkColumns[chunk.cx & 1];
+                columns.push_back(i);
+                columns.push_back(i + 1);
+            }
+            else
+                m_vChunkColumns[chunk.cx & 1].back() = i + 1;
+        }
+    }
+
+    inline void RadiusGrid::collideChunk(const id_t c)
+    {
+        const Chunk & chunk = m_vChunks[c];
+        for (id_t grid_id = chunk.aLUT[0]; grid_id < chunk.aLUT[ChunkCells]; ++grid_id)
+        {
+            const id_t ob1_id = m_vDynamicGrid[grid_id];
+            const id_t local  = m_vCellOf[ob1_id] & (ChunkCells - 1);
+            const i32  lx     = static_cast<i32>(local >> ChunkBits);
+            const i32  ly     = static_cast<i32>(local & (ChunkSize - 1));
+
+            Particle ob = m_objects->load(ob1_id);
+            if (chunk.uStatic != NoChunk)
+            {
+                const StaticChunk & s = m_vStaticChunks[chunk.uStatic];
+                collideStatic(ob, s.aLUT[local], s.aLUT[local + 1]);
+            }
+
+            // The same half neighbourhood as collideSubset, with columns and runs of rows that may
+            // continue into the chunks to the left, below and above
+            const auto gather = [&](const id_t cell0, const id_t cell1)
+            { collideCandidates(ob, m_vDynamicGrid.data() + cell0, cell1 - cell0); };
+            const auto rows = [&](i32 x, i32 y0, const i32 y1)
+            {
+                const i32 dx = x < 0 ? -1 : 0;
+                x -= dx * ChunkSize;
+                while (y0 <= y1)
+                {
+                    const i32  dy   = y0 < 0 ? -1 : (y0 >= ChunkSize ? 1 : 0);
+                    const i32  end  = std::min(y1, (dy + 1) * ChunkSize - 1);
+                    const id_t near = chunk.aNear[(dx + 1) * 3 + dy + 1];
+                    if (near != NoChunk)
+                    {
+                        const auto & lut = m_vChunks[near].aLUT;
+                        const id_t   a   = static_cast<id_t>(x * ChunkSize + y0 - dy * ChunkSize);
+                        gather(lut[a], lut[a + static_cast<id_t>(end - y0) + 1]);
+                    }
+                    y0 = end + 1;
+                }
+            };
+
+            if (lx >= 2 && ly >= 2 && ly < ChunkSize - 2)
+            {
+                // Inside the chunk, as collideSubset
+                const auto & lut = chunk.aLUT;
+                gather(lut[local - 2], grid_id);
+                gather(lut[local - ChunkSize - 2], lut[local - ChunkSize + 3]);
+                gather(lut[local - 2 * ChunkSize - 2], lut[local - 2 * ChunkSize + 3]);
+            }
+            else
+            {
+                rows(lx, ly - 2, ly - 1);
+                gather(chunk.aLUT[local], grid_id);
+                rows(lx - 1, ly - 2, ly + 2);
+                rows(lx - 2, ly - 2, ly + 2);
+            }
+
+            m_objects->store(ob1_id, ob);
+        }
+    }
+
+    inline void RadiusGrid::collideSparse()
+    {
+        // Particles reach into the column of chunks to their left, so columns of one parity are
+        // disjoint and run in parallel, even before odd as with stripes
+        for (const std::vector<u32> & columns : m_vChunkColumns)
+        {
+            const auto column = [&](const u32 i)
+            {
+                PROFILE_NAMED("collideStripe");
+                for (u32 c = columns[i * 2]; c < columns[i * 2 + 1]; ++c) collideChunk(m_vActiveChunks[c]);
+            };
+            const u32 n = static_cast<u32>(columns.size() / 2);
+            if (m_pPool) m_pPool->forEach(n, column);
+            else
+                for (u32 i = 0; i < n; ++i) column(i);
+        }
+    }
+
+    //-- Kinematic colliders
+    u32 RadiusGrid::addKinematic(const Collider::KinematicBox & box)
+    {
+        // Every cell of the dense grid holds one bit per collider, so sparse grids have none
+        if (m_bSparse || m_vKinematic.size() >= MaxKinematic) return NoKinematic;
+        if (m_vKinematicMask.empty()) m_vKinematicMask.assign(NSize, 0);
+
+        KinematicState k;
+        k.from = k.to = k.now = box;
+        m_vKinematic.push_back(k);
+
+        const u32 i = static_cast<u32>(m_vKinematic.size() - 1);
+        vec2      min, max;
+        box.Bounds(m_fMaxRadius, min, max);
+        cover(i, min, max);
+        return i;
+    }
+
+    void RadiusGrid::moveKinematic(const u32 i, const Collider::KinematicBox & box)
+    {
+        m_vKinematic[i].to = box;
+    }
+
+    void RadiusGrid::cover(const u32 i, const vec2 & min, const vec2 & max)
+    {
+        // Move the bit of collider i from its previous rectangle of cells to the new one, touching only
+        // the cells it leaves or enters
+        KinematicState & k    = m_vKinematic[i];
+        const auto       cell = [](const f32 p, const id_t size)
+        { return static_cast<id_t>(clamp(p * 2.0f + fBfrSize2, 0.0f, static_cast<f32>(size - 1))); };
+        const id_t x0 = cell(min.x, XSize), x1 = cell(max.x, XSize);
+        const id_t y0 = cell(min.y, YSize), y1 = cell(max.y, YSize);
+        if (x0 == k.x0 && x1 == k.x1 && y0 == k.y0 && y1 == k.y1) return;
+        const u64 bit = u64(1) << i;
+
+        // Cells of a outside b: whole columns beside b, the runs above and below it in the others
+        const auto outside = [this](const id_t ax0, const id_t ay0, const id_t ax1, const id_t ay1,
+                                    const id_t bx0, const id_t by0, const id_t bx1, const id_t by1,
+                                    const auto & visit)
+        {
+            for (id_t x = ax0; x <= ax1; ++x)
+            {
+                if (x < bx0 || x > bx1)
+                {
+                    for (id_t y = ay0; y <= ay1; ++y) visit(hash(x, y));
+                    continue;
                 }
+                for (id_t y = ay0; y <= ay1 && y < by0; ++y) visit(hash(x, y));
+                for (id_t y = std::max(ay0, by1 + 1); y <= ay1; ++y) visit(hash(x, y));
             }
+        };
+        outside(k.x0, k.y0, k.x1, k.y1, x0, y0, x1, y1, [&](const id_t h) { m_vKinematicMask[h] &= ~bit; });
+        outside(x0, y0, x1, y1, k.x0, k.y0, k.x1, k.y1, [&](const id_t h) { m_vKinematicMask[h] |= bit; });
+
+        k.x0 = x0, k.y0 = y0, k.x1 = x1, k.y1 = y1;
+    }
+
+    inline void RadiusGrid::stepKinematic()
+    {
+        // Colliders go from their last pose to their target over the substeps of one update
+        if (m_vKinematic.empty()) return;
+        if (m_uKinematicStep == 0)
+        {
+            const f32 inv = 1.0f / static_cast<f32>(m_uSubsteps);
+            for (u32 i = 0; i < m_vKinematic.size(); ++i)
+            {
+                KinematicState & k = m_vKinematic[i];
+                k.v                = (k.to.C - k.from.C) * inv;
+                k.w                = (k.to.angle - k.from.angle) * inv;
+
+                // Cover the whole sweep. A turning box stays within its circumcircle.
+                vec2 min0, max0, min1, max1;
+                k.from.Bounds(m_fMaxRadius, min0, max0);
+                k.to.Bounds(m_fMaxRadius, min1, max1);
+                if (k.w != 0.0f)
+                {
+                    const f32 r0 = std::sqrt(k.from.extent.dot(k.from.extent)) + m_fMaxRadius;
+                    const f32 r1 = std::sqrt(k.to.extent.dot(k.to.extent)) + m_fMaxRadius;
+                    min0 = k.from.C - vec2(r0, r0), max0 = k.from.C + vec2(r0, r0);
+                    min1 = k.to.C - vec2(r1, r1), max1 = k.to.C + vec2(r1, r1);
+                }
+                cover(i, vec2(std::min(min0.x, min1.x), std::min(min0.y, min1.y)),
+                      vec2(std::max(max0.x, max1.x), std::max(max0.y, max1.y)));
+            }
+        }
+
+        const f32 t = static_cast<f32>(++m_uKinematicStep) / static_cast<f32>(m_uSubsteps);
+        for (KinematicState & k : m_vKinematic)
+        {
+            k.now.C      = k.from.C + (k.to.C - k.from.C) * t;
+            k.now.extent = k.from.extent + (k.to.extent - k.from.extent) * t;
+            k.now.angle  = k.from.angle + (k.to.angle - k.from.angle) * t;
+        }
+        if (m_uKinematicStep == m_uSubsteps)
+        {
+            m_uKinematicStep = 0;
+            for (KinematicState & k : m_vKinematic) k.now = k.from = k.to;
         }
     }
 
+    void RadiusGrid::setThreads(const u32 threads)
+    {
+#if RADIUSGRID_STRIPES
+        if (threads > 1) m_pPool = std::make_unique<Parallel::ThreadPool>(threads);
+        else
+            m_pPool.reset();
+#else
+        (void) threads;
+#endif
+    }
+
     void RadiusGrid::update(const u32 active)
     {
 //        m_uCollideObjects += active;
 #ifdef COUNT_COLLISION_PAIRS
         m_dbgPairCounter.accumulate();
 #endif
-        // if (m_uUpdates % 6 == 0)
-        reconstruct(active);
+        const u64 t0 = PhaseClock();
+        stepKinematic();
+        if (m_bSparse) reconstructSparse(active);
+        else if (!m_vLevels.empty()) reconstructLevels(active);
+        else if (!m_vListStart.empty())
+        {
+            // The grid is only needed to rebuild the neighbour lists
+            if (listsValid(active)) ++m_listStats.uReuses;
+            else
+            {
+                reconstruct(active);
+                buildLists(active);
+                ++m_listStats.uBuilds;
+            }
+            m_fListMovedSq = -1.0f;
+        }
+        else
+            reconstruct(active);
+        m_uPlaced   = active;
+        m_bRemapped = false;
 
-        collideSubset(0, active);
+        const u64 t1 = PhaseClock();
+        if (m_bSparse) collideSparse();
+        else if (!m_vLevels.empty()) collideLevels(active);
+        else
+            collide(active);
         ++m_uUpdates;
+
+        m_phaseTimes.uReconstruct += t1 - t0;
+        m_phaseTimes.uCollide += PhaseClock() - t1;
+    }
+
+    u64 RadiusGrid::PhaseClock()
+    {
+#if PLSC_PROFILE
+        using namespace std::chrono;
+        return static_cast<u64>(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+#else
+        return 0;
+#endif
+    }
+
+    void RadiusGrid::refresh(const u32 active)
+    {
+        if (m_bSparse) reconstructSparse(active);
+        else if (!m_vLevels.empty()) reconstructLevels(active);
+        else
+            reconstruct(active);
+        m_uPlaced   = active;
+        m_bRemapped = false;
+    }
+
+    void RadiusGrid::removed(const u32 slot, const u32 last)
+    {
+        m_uListActive = 0;
+        if (slot >= m_uPlaced) return; // Neither particle is in the grid
+        if (last >= m_uPlaced)
+        {
+            // The particle moving into slot was added after the rebuild, so the grid does not know where
+            m_uPlaced   = 0;
+            m_bRemapped = false;
+            return;
+        }
+        if (!m_bRemapped)
+        {
+            m_vGridIndex.resize(m_uPlaced);
+            for (u32 i = 0; i < m_uPlaced; ++i) m_vGridIndex[m_vDynamicGrid[i]] = i;
+            m_bRemapped = true;
+        }
+
+        // As m_uPlaced <= active, last is m_uPlaced - 1 and no longer placed once it is removed
+        const id_t at = m_vGridIndex[slot];
+        m_vDynamicGrid[m_vGridIndex[last]] = slot;
+        m_vDynamicGrid[at]                 = last;
+        m_vGridIndex[slot]                 = m_vGridIndex[last];
+        m_vGridIndex[last]                 = at;
+        m_uPlaced                          = last;
+    }
+
+    void RadiusGrid::query(const vec2 & min, const vec2 & max, std::vector<id_t> & out) const
+    {
+        if (!m_uPlaced) return;
+        const auto cells = [&](const id_t begin, const id_t end)
+        {
+            if (!m_bRemapped)
+            {
+                out.insert(out.end(), m_vDynamicGrid.begin() + begin, m_vDynamicGrid.begin() + end);
+                return;
+            }
+            for (id_t i = begin; i < end; ++i)
+                if (m_vDynamicGrid[i] < m_uPlaced) out.push_back(m_vDynamicGrid[i]);
+        };
+
+        if (m_bSparse)
+        {
+            // Chunks that were not rebuilt hold no particles and an all zero LUT
+            const i32 x0 = static_cast<i32>(std::floor(min.x * 2.0f));
+            const i32 y0 = static_cast<i32>(std::floor(min.y * 2.0f));
+            const i32 x1 = static_cast<i32>(std::floor(max.x * 2.0f));
+            const i32 y1 = static_cast<i32>(std::floor(max.y * 2.0f));
+            for (i32 cx = x0 >> ChunkBits; cx <= x1 >> ChunkBits; ++cx)
+            {
+                for (i32 cy = y0 >> ChunkBits; cy <= y1 >> ChunkBits; ++cy)
+                {
+                    const id_t c = m_chunkTable.find(ChunkTable::key(cx, cy));
+                    if (c == NoChunk) continue;
+                    const Chunk & chunk = m_vChunks[c];
+                    const i32     lx0   = std::max(x0 - (cx << ChunkBits), 0);
+                    const i32     lx1   = std::min(x1 - (cx << ChunkBits), ChunkSize - 1);
+                    const i32     ly0   = std::max(y0 - (cy << ChunkBits), 0);
+                    const i32     ly1   = std::min(y1 - (cy << ChunkBits), ChunkSize - 1);
+                    for (i32 lx = lx0; lx <= lx1; ++lx)
+                        cells(chunk.aLUT[(lx << ChunkBits) | ly0], chunk.aLUT[((lx << ChunkBits) | ly1) + 1]);
+                }
+            }
+            return;
+        }
+
+        if (!m_vLevels.empty())
+        {
+            // Level cells are clamped the same way particles were placed, and column ordered
+            for (const Level & level : m_vLevels)
+            {
+                const id_t h0 = level.hash(min.x, min.y);
+                const id_t h1 = level.hash(max.x, max.y);
+                for (id_t x = h0 / level.YSize; x <= h1 / level.YSize; ++x)
+                {
+                    const id_t column = x * level.YSize;
+                    cells(level.vLUT[column + h0 % level.YSize], level.vLUT[column + h1 % level.YSize + 1]);
+                }
+            }
+            return;
+        }
+
+        const f32  maxX = static_cast<f32>(XSize - 1);
+        const f32  maxY = static_cast<f32>(YSize - 1);
+        const id_t x0   = static_cast<id_t>(clamp(min.x * 2.0f + fBfrSize2, 0.0f, maxX));
+        const id_t y0   = static_cast<id_t>(clamp(min.y * 2.0f + fBfrSize2, 0.0f, maxY));
+        const id_t x1   = static_cast<id_t>(clamp(max.x * 2.0f + fBfrSize2, 0.0f, maxX));
+        const id_t y1   = static_cast<id_t>(clamp(max.y * 2.0f + fBfrSize2, 0.0f, maxY));
+        for (id_t x = x0; x <= x1; ++x)
+        {
+            for (id_t y = y0; y <= y1; ++y)
+            {
+                const id_t h = hash(x, y);
+                cells(m_vDynamicLUT[h], m_vDynamicLUT[h + 1]);
+            }
+        }
     }
 
 } // namespace PLSC
\ No newline at end of file
@@ -0,0 +1,234 @@
+#include "PLSC/Physics/SDF.hpp"
+
+#include "PLSC/Math/Util.hpp" // clamp
+
+#include <algorithm> // min, sort
+#include <cassert>
+#include <cmath>
+
+namespace PLSC::Collider
+{
+    namespace
+    {
+        using Field  = SDF::Field;
+        using Sample = SDF::Sample;
+
+        // Field covering [min, max] grown by margin
+        std::shared_ptr<Field> mkField(vec2 min, vec2 max, const f32 cell, const f32 margin)
+        {
+            auto f    = std::make_shared<Field>();
+            min       = min - vec2(margin, margin);
+            max       = max + vec2(margin, margin);
+            f->origin = min;
+            f->cell   = cell;
+            f->inv    = 1.0f / cell;
+            f->margin = margin;
+            f->nx     = static_cast<u32>(std::ceil((max.x - min.x) * f->inv)) + 2;
+            f->ny     = static_cast<u32>(std::ceil((max.y - min.y) * f->inv)) + 2;
+            f->samples.assign(static_cast<size_t>(f->nx) * f->ny, {margin, 0.0f, 0.0f});
+            return f;
+        }
+
+        inline vec2 position(const Field &f, const u32 x, const u32 y)
+        {
+            return f.origin + vec2(static_cast<f32>(x), static_cast<f32>(y)) * f.cell;
+        }
+
+        // Unsigned distance to the segments of points, up to the margin around each segment
+        void distance(Field &f, const std::vector<vec2> &points, const bool closed, const f32 margin)
+        {
+            const size_t n = closed ? points.size() : points.size() - 1;
+            for (size_t i = 0; i < n; ++i)
+            {
+                const vec2 a  = points[i];
+                const vec2 b  = points[(i + 1) % points.size()];
+                const vec2 ab = b - a;
+                const f32  l2 = ab.magSq();
+
+                const auto sample = [&](const f32 p, const f32 o, const u32 size)
+                { return static_cast<u32>(clamp((p - o) * f.inv, 0.0f, static_cast<f32>(size - 1))); };
+                const u32 x0 = sample(std::min(a.x, b.x) - margin, f.origin.x, f.nx);
+                const u32 x1 = sample(std::max(a.x, b.x) + margin, f.origin.x, f.nx) + 1;
+                const u32 y0 = sample(std::min(a.y, b.y) - margin, f.origin.y, f.ny);
+                const u32 y1 = sample(std::max(a.y, b.y) + margin, f.origin.y, f.ny) + 1;
+                for (u32 y = y0; y < std::min(y1, f.ny); ++y)
+                {
+                    for (u32 x = x0; x < std::min(x1, f.nx); ++x)
+                    {
+                        const vec2 ap = position(f, x, y) - a;
+                        const f32  t  = l2 > FLT_EPSILON ? clamp(ap.dot(ab) / l2, 0.0f, 1.0f) : 0.0f;
+                        const f32  d  = (ap - ab * t).mag();
+                        f32       &s  = f.samples[y * f.nx + x].d;
+                        s             = std::min(s, d);
+                    }
+                }
+            }
+        }
+
+        // Negate the samples inside the polygon, even-odd rule along each row
+        void sign(Field &f, const std::vector<vec2> &points)
+        {
+            std::vector<f32> crossings;
+            for (u32 y = 0; y < f.ny; ++y)
+            {
+                const f32 py = position(f, 0, y).y;
+                crossings.clear();
+                for (size_t i = 0; i < points.size(); ++i)
+                {
+                    const vec2 a = points[i];
+                    const vec2 b = points[(i + 1) % points.size()];
+                    if ((a.y <= py) == (b.y <= py)) continue;
+                    crossings.push_back(a.x + (py - a.y) / (b.y - a.y) * (b.x - a.x));
+                }
+                std::sort(crossings.begin(), crossings.end());
+
+                size_t c = 0;
+                for (u32 x = 0; x < f.nx; ++x)
+                {
+                    const f32 px = position(f, x, y).x;
+                    while (c < crossings.size() && crossings[c] < px) ++c;
+                    if (c & 1) f.samples[y * f.nx + x].d = -f.samples[y * f.nx + x].d;
+                }
+            }
+        }
+
+        // Central differences, one-sided at the edges of the field
+        void gradient(Field &f)
+        {
+            const auto d = [&](const u32 x, const u32 y) { return f.samples[y * f.nx + x].d; };
+            for (u32 y = 0; y < f.ny; ++y)
+            {
+                for (u32 x = 0; x < f.nx; ++x)
+                {
+                    const u32 xl = x > 0 ? x - 1 : x, xr = x + 1 < f.nx ? x + 1 : x;
+                    const u32 yl = y > 0 ? y - 1 : y, yr = y + 1 < f.ny ? y + 1 : y;
+                    Sample   &s  = f.samples[y * f.nx + x];
+                    s.gx         = (d(xr, y) - d(xl, y)) / (static_cast<f32>(xr - xl) * f.cell);
+                    s.gy         = (d(x, yr) - d(x, yl)) / (static_cast<f32>(yr - yl) * f.cell);
+                }
+            }
+        }
+
+        // Squared distance transform of one line (Felzenszwalb & Huttenlocher)
+        void edt(const f32 *in, f32 *out, const u32 n, u32 *v, f32 *z)
+        {
+            const auto cut = [&](const u32 q, const u32 p)
+            {
+                const f32 fq = static_cast<f32>(q), fp = static_cast<f32>(p);
+                return ((in[q] + fq * fq) - (in[p] + fp * fp)) / (2.0f * (fq - fp));
+            };
+
+            u32 k = 0;
+            v[0]  = 0;
+            z[0]  = -FLT_MAX;
+            z[1]  = FLT_MAX;
+            for (u32 q = 1; q < n; ++q)
+            {
+                f32 s = cut(q, v[k]);
+                while (k > 0 && s <= z[k]) s = cut(q, v[--k]);
+                v[++k]   = q;
+                z[k]     = s;
+                z[k + 1] = FLT_MAX;
+            }
+            k = 0;
+            for (u32 q = 0; q < n; ++q)
+            {
+                while (z[k + 1] < static_cast<f32>(q)) ++k;
+                const f32 dq = static_cast<f32>(q) - static_cast<f32>(v[k]);
+                out[q]       = dq * dq + in[v[k]];
+            }
+        }
+
+        // Squared distance in pixels to the nearest pixel where solid == feature
+        std::vector<f32> edt(const std::vector<bool> &solid, const bool feature, const u32 w, const u32 h)
+        {
+            constexpr f32    Far = 1e20f;
+            const u32        n   = std::max(w, h);
+            std::vector<f32> grid(static_cast<size_t>(w) * h), in(n), out(n), z(n + 1);
+            std::vector<u32> v(n);
+            for (size_t i = 0; i < grid.size(); ++i) grid[i] = solid[i] == feature ? 0.0f : Far;
+
+            for (u32 x = 0; x < w; ++x)
+            {
+                for (u32 y = 0; y < h; ++y) in[y] = grid[y * w + x];
+                edt(in.data(), out.data(), h, v.data(), z.data());
+                for (u32 y = 0; y < h; ++y) grid[y * w + x] = out[y];
+            }
+            for (u32 y = 0; y < h; ++y)
+            {
+                edt(grid.data() + y * w, out.data(), w, v.data(), z.data());
+                std::copy(out.begin(), out.begin() + w, grid.begin() + y * w);
+            }
+            return grid;
+        }
+
+        void bounds(const std::vector<vec2> &points, vec2 &min, vec2 &max)
+        {
+            min = max = points[0];
+            for (const vec2 &p : points)
+            {
+                min = vec2(std::min(min.x, p.x), std::min(min.y, p.y));
+                max = vec2(std::max(max.x, p.x), std::max(max.y, p.y));
+            }
+        }
+    } // namespace
+
+    SDF SDF::FromPolyline(const std::vector<vec2> &points, const f32 thickness, const f32 cell,
+                          const f32 margin)
+    {
+        assert(points.size() >= 2);
+        const f32 half = thickness * 0.5f;
+        vec2      min, max;
+        bounds(points, min, max);
+
+        auto f = mkField(min, max, cell, margin + half);
+        distance(*f, points, false, margin + half);
+        for (Sample &s : f->samples) s.d -= half;
+        gradient(*f);
+        return SDF(f);
+    }
+
+    SDF SDF::FromPolygon(const std::vector<vec2> &points, const bool inverted, const f32 cell,
+                         const f32 margin)
+    {
+        assert(points.size() >= 3);
+        vec2 min, max;
+        bounds(points, min, max);
+
+        auto f = mkField(min, max, cell, margin);
+        distance(*f, points, true, margin);
+        sign(*f, points);
+        if (inverted)
+            for (Sample &s : f->samples) s.d = -s.d;
+        gradient(*f);
+        return SDF(f);
+    }
+
+    SDF SDF::FromBitmap(const u8_t *pixels, const u32 width, const u32 height, const vec2 &origin,
+                        const f32 pixelSize, const u8_t threshold, const f32 margin)
+    {
+        assert(width >= 2 && height >= 2);
+        auto f    = std::make_shared<Field>();
+        f->origin = origin;
+        f->cell   = pixelSize;
+        f->inv    = 1.0f / pixelSize;
+        f->margin = margin;
+        f->nx     = width;
+        f->ny     = height;
+        f->samples.resize(static_cast<size_t>(width) * height);
+
+        std::vector<bool> solid(f->samples.size());
+        for (size_t i = 0; i < solid.size(); ++i) solid[i] = pixels[i] >= threshold;
+
+        // The surface runs along pixel edges, half a pixel from the centres on either side
+        const std::vector<f32> outside = edt(solid, true, width, height);
+        const std::vector<f32> inside  = edt(solid, false, width, height);
+        for (size_t i = 0; i < solid.size(); ++i)
+        {
+            const f32 d     = solid[i] ? -(std::sqrt(inside[i]) - 0.5f) : std::sqrt(outside[i]) - 0.5f;
+            f->samples[i].d = clamp(d * pixelSize, -margin, margin);
+        }
+        gradient(*f);
+        return SDF(f);
+    }
+} // namespace PLSC::Collider
@@ -2,7 +2,13 @@
 
 #include "PLSC/Constants.hpp"
 #include "PLSC/DBG/Profile.hpp"
-#include "PLSC/Math/Util.hpp" // clamp
+#include "PLSC/Math/Random.hpp" // mix
+#include "PLSC/Math/Util.hpp"   // clamp
+
+#include <algorithm>  // max, min, remove_if, sort, unique
+#include <cfloat>     // FLT_MAX
+#include <cmath>      // ceil, cos, floor, NAN, sin, sqrt
+#include <functional> // greater
 
 namespace PLSC
 {
@@ -11,38 +17,408 @@ namespace PLSC
     void Solver::update()
     {
         PROFILE_COMPLEXITY(m_active);
-        for (u32 i(Constants::Substep); i--;)
+        for (Emitter & e : m_emitters)
+        {
+            e.fCarry += e.fRate;
+            const u32 n = static_cast<u32>(e.fCarry);
+            e.fCarry -= static_cast<f32>(n);
+            emit(e, n);
+        }
+        if (m_gravity.x != m_lastGravity.x || m_gravity.y != m_lastGravity.y)
+        {
+            // Sleeping particles ignore gravity, so they would float after a change
+            m_objects.wakeAll(m_active);
+            m_lastGravity = m_gravity;
+        }
+
+        // Velocities are per m_config.Substep between updates, and per substep of this update inside it
+        const u32  substeps = m_uSubsteps;
+        const f32  k        = static_cast<f32>(m_config.Substep) / static_cast<f32>(substeps);
+        const vec2 gravity  = m_gravity * (k * k);
+        if (substeps != m_config.Substep) m_objects.scaleVelocity(m_active, k);
+
+        f32 travelSq = 0, pushSq = 0;
+        for (u32 i = 0; i < substeps; ++i)
         {
             updateCollisions();
-            updateObjects();
+            const u64 t0 = RadiusGrid::PhaseClock();
+            if (m_config.AdaptiveSubstep && i + 2 >= substeps)
+            {
+                // How far particles move in the last two substeps, and in the last one how far the
+                // collisions just resolved pushed them from where the integration before left them.
+                // The substeps before integrate as fixed counts do.
+                m_objects.update(m_active, gravity, m_vPrevX.data(), m_vPrevY.data(), i + 1 == substeps,
+                                 travelSq, pushSq);
+            }
+            else if (i + 1 < substeps && m_collisionStructure.listX())
+            {
+                // Nothing else moves particles before the next substep, so the integration can tell the
+                // grid how far they are from its neighbour lists
+                m_collisionStructure.moved(m_objects.update(m_active, gravity, m_collisionStructure.listX(),
+                                                            m_collisionStructure.listY()));
+            }
+            else
+                updateObjects(gravity);
+            m_uIntegrateNs += RadiusGrid::PhaseClock() - t0;
         }
+        if (substeps != m_config.Substep) m_objects.scaleVelocity(m_active, 1.0f / k);
+        if (m_config.AdaptiveSubstep) adapt(travelSq, pushSq);
+
+        m_uParticleSubsteps += static_cast<u64>(m_active) * substeps;
+        m_uSubstepsRun += substeps;
+        ++m_uUpdatesRun;
+        m_uLastSubsteps = substeps;
         ++m_updates;
+        if (m_config.ReorderInterval && m_updates % m_config.ReorderInterval == 0) reorder();
+        sink(); // After reorder(), which follows the slots of the last grid rebuild
+        publish();
+    }
+
+    void Solver::adapt(const f32 travelSq, const f32 pushSq)
+    {
+        // Travel per update does not depend on the substep length. The push of the last substep is the
+        // overlap collisions keep resolving, which shrinks with the square of the substep length; at rest
+        // it is the weight of piles. That depth may hold the count up to Substep but not raise it beyond;
+        // only travel, or a push grown past what the last update predicted for this count, do.
+        const f32 d      = Constants::CircleDiameter;
+        const f32 n      = static_cast<f32>(m_uSubsteps);
+        const f32 limit  = static_cast<f32>(m_config.SubstepPush) * d;
+        const f32 push   = std::sqrt(pushSq);
+        const f32 grown  = m_fNextPush < 0 ? 0.0f : std::max(push - m_fNextPush, 0.0f);
+        const f32 travel = n * std::sqrt(travelSq) / (static_cast<f32>(m_config.SubstepTravel) * d);
+        const f32 depth  = std::min(n * std::sqrt(push / limit), static_cast<f32>(m_config.Substep));
+        const f32 need   = std::max(std::max(travel, depth), n * std::sqrt(grown / limit));
+
+        // A different count settles piles at a different depth, which shakes them. So rise at once,
+        // but only fall with a clear margin, by an eighth at most.
+        const u32 high = m_config.SubstepHigh();
+        const u32 fall = m_uSubsteps - std::max(m_uSubsteps / 8, 1u);
+        u32       next = static_cast<u32>(std::ceil(std::min(need, static_cast<f32>(high))));
+        if (next < m_uSubsteps) next = need < n * 0.75f ? std::max(next, fall) : m_uSubsteps;
+        m_uSubsteps = std::min(std::max(next, m_config.SubstepLow()), high);
+        m_collisionStructure.setSubsteps(m_uSubsteps);
+
+        const f32 k = n / static_cast<f32>(m_uSubsteps);
+        m_fNextPush = push * k * k;
+    }
+
+    u32 Solver::addKinematic(const Collider::KinematicBox & box)
+    {
+        return m_collisionStructure.addKinematic(box);
+    }
+
+    void Solver::moveKinematic(const u32 i, const Collider::KinematicBox & box)
+    {
+        m_collisionStructure.moveKinematic(i, box);
+    }
+
+    bool Solver::remove(const u32 id)
+    {
+        if (id >= m_objects.capacity()) return false;
+        const u32 slot = m_objects.slot(id);
+        if (slot >= m_active) return false;
+
+        const vec2 P(m_objects.Px[slot], m_objects.Py[slot]);
+        removeSlot(slot);
+        wakeNear(P);
+        return true;
+    }
+
+    inline void Solver::removeSlot(const u32 slot)
+    {
+        m_collisionStructure.removed(slot, m_active - 1);
+        m_objects.swap(slot, m_active - 1);
+        --m_active;
+        m_objects.retire(m_active);
+        ++m_uRemoved;
+    }
+
+    void Solver::wakeNear(const vec2 & P)
+    {
+        // Whatever rested on a particle removed at P falls again. Sleepers are found through the grid;
+        // particles added since its last rebuild are awake.
+        if (!m_objects.Rest) return;
+        if (!m_collisionStructure.placed() && m_active) m_collisionStructure.refresh(m_active);
+        const f32  d   = Constants::CircleDiameter * 2.0f;
+        const f32  w   = d + m_collisionStructure.queryMargin();
+        const vec2 min = P - vec2(d, d), max = P + vec2(d, d);
+        m_vNear.clear();
+        m_collisionStructure.query(P - vec2(w, w), P + vec2(w, w), m_vNear);
+        for (const id_t slot : m_vNear)
+        {
+            const f32 x = m_objects.Px[slot], y = m_objects.Py[slot];
+            if (x >= min.x && x <= max.x && y >= min.y && y <= max.y) m_objects.wake(slot);
+        }
+    }
+
+    void Solver::sink()
+    {
+        if (m_sinks.m_interfaces.empty()) return;
+        PROFILE();
+
+        // Each sink tests the particles the grid holds under its bounds and those added since the last
+        // rebuild; a sink without bounds, such as an InverseAABB, tests all of them
+        if (!m_collisionStructure.placed() && m_active) m_collisionStructure.refresh(m_active);
+        const u32  placed = m_collisionStructure.placed();
+        const f32  margin = m_collisionStructure.queryMargin();
+        const auto test   = [this](const auto & s, const u32 slot)
+        {
+            Particle ob = m_objects.load(slot);
+            if (s->Intersects(&ob)) m_vSunk.push_back(slot);
+        };
+        m_vSunk.clear();
+        for (const auto & s : m_sinks.m_interfaces)
+        {
+            vec2 min, max;
+            s->Bounds(m_config.MaxRadius(), min, max);
+            if (min.x == -FLT_MAX || min.y == -FLT_MAX || max.x == FLT_MAX || max.y == FLT_MAX)
+            {
+                for (u32 i = 0; i < m_active; ++i) test(s, i);
+                continue;
+            }
+            m_vNear.clear();
+            m_collisionStructure.query(min - vec2(margin, margin), max + vec2(margin, margin), m_vNear);
+            for (const id_t slot : m_vNear) test(s, slot);
+            for (u32 i = placed; i < m_active; ++i) test(s, i);
+        }
+
+        // From the back, so the particle swapped into a freed slot is never one still to be removed
+        std::sort(m_vSunk.begin(), m_vSunk.end(), std::greater<u32>());
+        m_vSunk.erase(std::unique(m_vSunk.begin(), m_vSunk.end()), m_vSunk.end());
+        for (const u32 slot : m_vSunk)
+        {
+            const vec2 P(m_objects.Px[slot], m_objects.Py[slot]);
+            removeSlot(slot);
+            wakeNear(P);
+        }
+    }
+
+    inline void Solver::append(const Particle & ob)
+    {
+        // The slot may still hold the rest count of a removed particle
+        m_objects.store(m_active, ob);
+        if (m_objects.Rest) m_objects.wake(m_active);
+        ++m_active;
+    }
+
+    u32 Solver::emit(Emitter & e, u32 count)
+    {
+        if (e.uLimit)
+        {
+            const u64 left = e.uLimit - std::min(e.uLimit, e.uEmitted);
+            count          = static_cast<u32>(std::min<u64>(count, left));
+        }
+        count = std::min(count, m_config.MaxInstances - m_active);
+        if (!count) return 0;
+        PROFILE_COMPLEXITY(count);
+
+        // Particles [0, placed) are found through the grid, the rest through a hash of cells one largest
+        // diameter wide, which also receives the new ones. After reorder() the grid is rebuilt first, so
+        // the hash stays as small as what was added since the last update; removals keep it usable.
+        if (!m_collisionStructure.placed() && m_active) m_collisionStructure.refresh(m_active);
+        const u32 placed = m_collisionStructure.placed();
+        const f32 rmax   = m_config.MaxRadius();
+        const f32 inv    = 0.5f / rmax;
+        const f32 margin = m_collisionStructure.queryMargin();
+        const f32 dt     = static_cast<f32>(m_config.SubstepDelta());
+
+        size_t size = 16;
+        while (size < 2 * (static_cast<size_t>(m_active - placed) + count)) size += size;
+        m_vEmitKeys.resize(size);
+        m_vEmitHeads.assign(size, ~0u);
+        m_vEmitNext.resize(m_active - placed + count);
+
+        const auto key = [inv](const f32 x, const f32 y, const i32 dx, const i32 dy)
+        {
+            const i32 cx = static_cast<i32>(std::floor(x * inv)) + dx;
+            const i32 cy = static_cast<i32>(std::floor(y * inv)) + dy;
+            return (static_cast<u64>(static_cast<u32>(cx)) << 32) | static_cast<u32>(cy);
+        };
+        const auto find = [this](const u64 k)
+        {
+            // Open addressing, the hash slot of k or the empty one where it would go
+            const size_t mask = m_vEmitKeys.size() - 1;
+            size_t       i    = Random::mix(k) & mask;
+            while (m_vEmitHeads[i] != ~0u && m_vEmitKeys[i] != k) i = (i + 1) & mask;
+            return i;
+        };
+        const auto insert = [&](const u32 slot)
+        {
+            const u64    k             = key(m_objects.Px[slot], m_objects.Py[slot], 0, 0);
+            const size_t i             = find(k);
+            m_vEmitKeys[i]             = k;
+            m_vEmitNext[slot - placed] = m_vEmitHeads[i];
+            m_vEmitHeads[i]            = slot - placed;
+        };
+        const auto overlaps = [&](const vec2 & P, const f32 r, const u32 slot)
+        {
+            const f32 reach = r + (m_objects.R ? m_objects.R[slot] : Constants::CircleRadius);
+            return P.distSq(vec2(m_objects.Px[slot], m_objects.Py[slot])) < reach * reach;
+        };
+        const auto vacant = [&](const vec2 & P, const f32 r)
+        {
+            const vec2 reach(r + rmax + margin, r + rmax + margin);
+            m_vNear.clear();
+            m_collisionStructure.query(P - reach, P + reach, m_vNear);
+            for (const id_t slot : m_vNear)
+                if (overlaps(P, r, slot)) return false;
+            for (i32 dx = -1; dx <= 1; ++dx)
+            {
+                for (i32 dy = -1; dy <= 1; ++dy)
+                {
+                    for (u32 i = m_vEmitHeads[find(key(P.x, P.y, dx, dy))]; i != ~0u; i = m_vEmitNext[i])
+                        if (overlaps(P, r, placed + i)) return false;
+                }
+            }
+            return true;
+        };
+
+        for (u32 slot = placed; slot < m_active; ++slot) insert(slot);
+
+        u32 added = 0;
+        for (u32 n = 0; n < count; ++n)
+        {
+            Particle ob;
+            if (m_objects.R) ob.r = m_random.uniform(Constants::CircleRadius, rmax);
+
+            // A point has nowhere else to try
+            const u32 tries = e.uShape == Emitter::Point ? 1 : e.uTries;
+            bool      found = false;
+            for (u32 t = 0; t < tries && !found; ++t)
+            {
+                switch (e.uShape)
+                {
+                    case Emitter::Point: ob.P = e.A; break;
+                    case Emitter::Line: ob.P = e.A + (e.B - e.A) * m_random.uniform(); break;
+                    case Emitter::Region:
+                        ob.P.x = m_random.uniform(e.A.x, e.B.x);
+                        ob.P.y = m_random.uniform(e.A.y, e.B.y);
+                        break;
+                }
+                found = vacant(ob.P, ob.r);
+            }
+            if (!found)
+            {
+                ++e.uDropped;
+                continue;
+            }
+
+            vec2 v = e.V;
+            if (e.fSpread > 0.0f)
+            {
+                const f32 angle = m_random.uniform(0.0f, static_cast<f32>(2.0 * M_PI));
+                const f32 speed = m_random.uniform(0.0f, e.fSpread);
+                v += vec2(std::cos(angle), std::sin(angle)) * speed;
+            }
+            ob.dP = ob.P - v * dt;
+            append(ob);
+            insert(m_active - 1);
+            ++added;
+        }
+        e.uEmitted += added;
+        return added;
+    }
+
+    std::shared_ptr<Solver::SnapshotBuffer> Solver::subscribe()
+    {
+        m_vSnapshots.push_back(std::make_shared<SnapshotBuffer>());
+        return m_vSnapshots.back();
+    }
+
+    void Solver::publish()
+    {
+        // Readers that let go of their buffer are only referenced from here
+        const auto dropped = [](const std::shared_ptr<SnapshotBuffer> & b) { return b.use_count() == 1; };
+        m_vSnapshots.erase(std::remove_if(m_vSnapshots.begin(), m_vSnapshots.end(), dropped),
+                           m_vSnapshots.end());
+        if (m_vSnapshots.empty()) return;
+        PROFILE();
+
+        Snapshot & first = m_vSnapshots[0]->back();
+        first.uFrame     = m_updates;
+        first.vP.assign(idBound(), vec2(NAN, NAN));
+        first.vGeneration.resize(first.vP.size());
+        for (u32 i = 0; i < m_active; ++i) first.vP[m_objects.id(i)] = vec2(m_objects.Px[i], m_objects.Py[i]);
+        for (u32 id = 0; id < first.vP.size(); ++id) first.vGeneration[id] = m_objects.generation(id);
+        for (size_t i = 1; i < m_vSnapshots.size(); ++i) m_vSnapshots[i]->back() = first;
+        for (const auto & b : m_vSnapshots) b->publish();
+    }
+
+    Solver::PhaseTimes Solver::phaseTimes() const
+    {
+        const RadiusGrid::PhaseTimes & grid = m_collisionStructure.phaseTimes();
+        PhaseTimes                     t;
+        t.uReconstruct      = grid.uReconstruct;
+        t.uCollide          = grid.uCollide;
+        t.uIntegrate        = m_uIntegrateNs;
+        t.uParticleSubsteps = m_uParticleSubsteps;
+        t.uSubsteps         = m_uSubstepsRun;
+        t.uUpdates          = m_uUpdatesRun;
+        return t;
+    }
+
+    void Solver::resetPhaseTimes()
+    {
+        m_collisionStructure.resetPhaseTimes();
+        m_uIntegrateNs      = 0;
+        m_uParticleSubsteps = 0;
+        m_uSubstepsRun      = 0;
+        m_uUpdatesRun       = 0;
+    }
+
+    void Solver::reorder()
+    {
+        // Sort storage into the order particles are collided in, by the last grid rebuild. Only a grid
+        // of exactly the active slots, and none removed since, is a permutation of them.
+        const id_t * order = m_collisionStructure.order();
+        if (!order || m_collisionStructure.placed() != m_active) return;
+        PROFILE();
+        m_objects.permute(order, m_active);
+        m_collisionStructure.invalidate();
     }
 
     void Solver::spawnRandom()
     {
-        if (m_active >= Constants::MaxDynamicInstances) return;
-        for (u32 i = 0; i < Constants::CirclesPerWidth; ++i)
+        const u32 maxInstances = m_config.MaxInstances;
+        if (m_active >= maxInstances) return;
+        if (m_config.Polydisperse())
+        {
+            // Row of random radii, packed side by side
+            const f32 rmax = m_config.MaxRadius();
+            for (f32 x = 0.0f; m_active < maxInstances;)
+            {
+                f32 rand_norm0 = m_random.uniform();
+                f32 rand_norm1 = m_random.uniform();
+
+                Particle ob;
+                ob.r = Constants::CircleRadius + (rmax - Constants::CircleRadius) * rand_norm0;
+                x += ob.r;
+                if (x + ob.r > m_config.Width()) return;
+
+                ob.P  = vec2(x, std::max(ob.r, m_config.Height() * 0.5f * rand_norm1));
+                ob.dP = ob.P;
+                append(ob);
+                x += ob.r;
+            }
+            return;
+        }
+        for (u32 i = 0; i < m_config.CirclesPerWidth(); ++i)
         {
-            if (m_active > Constants::MaxDynamicInstances - 1) return;
-            f32 rand_norm0 = ((f32) rand() / (f32) RAND_MAX);
-            f32 rand_norm1 = ((f32) rand() / (f32) RAND_MAX);
+            if (m_active > maxInstances - 1) return;
+            f32 rand_norm0 = m_random.uniform();
+            f32 rand_norm1 = m_random.uniform();
 
             f32 x = Constants::CircleRadius + (Constants::CircleDiameter * static_cast<f32>(i));
-            f32 y = Constants::WorldHeight * 0.5f * rand_norm1;
+            f32 y = m_config.Height() * 0.5f * rand_norm1;
 
             x += (Constants::CircleDiameter * rand_norm0) - Constants::CircleRadius;
 
-            vec2 P              = {x, y};
-            m_objects[m_active] = Particle(P);
-            ++m_active;
+            vec2 P = {x, y};
+            append(Particle(P));
         }
     }
 
-    void Solver::updateObjects()
-    {
-        for (u32 i = 0; i < m_active; ++i) { m_objects[i].update(m_gravity); }
-    }
+    void Solver::updateObjects(const vec2 & gravity) { m_objects.update(m_active, gravity); }
 
     void Solver::updateCollisions() { m_collisionStructure.update(m_active); }
 } // namespace PLSC
\ No newline at end of file
@@ -0,0 +1,64 @@
+#include "PLSC/Parallel/ThreadPool.hpp"
+
+namespace PLSC::Parallel
+{
+    ThreadPool::ThreadPool(const u32 threads)
+    {
+        const u32 workers = threads > 1 ? threads - 1 : 0;
+        m_vThreads.reserve(workers);
+        for (u32 i = 0; i < workers; ++i) { m_vThreads.emplace_back(&ThreadPool::workerMain, this); }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_bQuit = true;
+        }
+        m_cvStart.notify_all();
+        for (std::thread & t : m_vThreads) t.join();
+    }
+
+    void ThreadPool::dispatch(const u32 n, const task_fn fn, void * const ctx)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_fn  = fn;
+            m_ctx = ctx;
+            m_n   = n;
+            m_uNext.store(0, std::memory_order_relaxed);
+            m_uBusy = static_cast<u32>(m_vThreads.size());
+            ++m_uGeneration;
+        }
+        m_cvStart.notify_all();
+
+        work();
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cvDone.wait(lock, [this] { return m_uBusy == 0; });
+    }
+
+    void ThreadPool::work()
+    {
+        for (u32 i; (i = m_uNext.fetch_add(1, std::memory_order_relaxed)) < m_n;) { m_fn(m_ctx, i); }
+    }
+
+    void ThreadPool::workerMain()
+    {
+        u32 seen = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cvStart.wait(lock, [this, seen] { return m_bQuit || m_uGeneration != seen; });
+                if (m_bQuit) return;
+                seen = m_uGeneration;
+            }
+
+            work();
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_uBusy == 0) m_cvDone.notify_one();
+        }
+    }
+} // namespace PLSC::Parallel
@@ -0,0 +1,381 @@
+#include "PLSC/IO/Trajectory.hpp"
+
+#include "PLSC/Constants.hpp"
+#include "PLSC/DBG/Profile.hpp"
+#include "PLSC/Math/Util.hpp" // clamp
+#include "PLSC/Physics/Solver.hpp"
+
+#include <algorithm> // fill, max
+#include <cmath>     // isnan, lrintf, NAN
+#include <cstdint>   // INT32_MIN
+
+//- File: TrajectoryHeader, then frames of
+//-     FrameHeader
+//-     uBytes of varints: the x deltas of particles [0, uCount), then the y deltas, then the uReplaced
+//-     replaced ids, each as the difference to the one before
+
+namespace PLSC::IO
+{
+    namespace
+    {
+        constexpr u32 Magic      = 0x54534c50; // "PLST"
+        constexpr u32 FrameMagic = 0x454d5246; // "FRME"
+        constexpr u32 Version    = 2;
+
+        enum FrameFlags : u32
+        {
+            Key = 1,
+        };
+
+        struct FrameHeader
+        {
+            u32 uMagic    = FrameMagic;
+            u32 uFrame    = 0;
+            u32 uCount    = 0;
+            u32 uFlags    = 0;
+            u32 uBytes    = 0;
+            u32 uReplaced = 0;
+        };
+
+        // Keeps quantized positions well inside i32 and deltas inside 32 bits
+        constexpr f32 QuantizedLimit = 1 << 29;
+
+        // Quantized value of ids without a particle, outside of the limits
+        constexpr i32 Gap = INT32_MIN;
+
+        inline i32 quantize(const f32 x, const f32 inv)
+        {
+            if (std::isnan(x)) return Gap;
+            return static_cast<i32>(std::lrintf(clamp(x * inv, -QuantizedLimit, QuantizedLimit)));
+        }
+
+        inline u8_t * putVarint(u8_t * out, const i32 delta)
+        {
+            // Zigzag, so small negative deltas stay short
+            u32 v = (static_cast<u32>(delta) << 1) ^ static_cast<u32>(delta >> 31);
+            while (v >= 0x80)
+            {
+                *out++ = static_cast<u8_t>(v | 0x80);
+                v >>= 7;
+            }
+            *out++ = static_cast<u8_t>(v);
+            return out;
+        }
+
+        inline const u8_t * getVarint(const u8_t * in, const u8_t * end, i32 & delta)
+        {
+            u32 v = 0;
+            for (u32 shift = 0; in < end && shift < 35; shift += 7)
+            {
+                const u8_t c = *in++;
+                v |= static_cast<u32>(c & 0x7f) << shift;
+                if (!(c & 0x80))
+                {
+                    delta = static_cast<i32>((v >> 1) ^ (0u - (v & 1)));
+                    return in;
+                }
+            }
+            return nullptr;
+        }
+    } // namespace
+
+    bool TrajectoryWriter::open(const char * const path, const Solver & solver, const Options & options)
+    {
+        close();
+        m_pFile = std::fopen(path, "wb");
+        if (!m_pFile) return false;
+
+        m_options              = options;
+        m_options.uBuffers     = std::max(m_options.uBuffers, 1u);
+        m_options.uKeyInterval = std::max(m_options.uKeyInterval, 1u);
+
+        TrajectoryHeader h;
+        h.uMagic        = Magic;
+        h.uVersion      = Version;
+        h.uCapacity     = solver.m_config.MaxInstances;
+        h.uFractionBits = m_options.uFractionBits;
+        h.uKeyInterval  = m_options.uKeyInterval;
+        h.fWidth        = solver.m_config.Width();
+        h.fHeight       = solver.m_config.Height();
+        h.fQuantum      = Constants::CircleRadius / static_cast<f32>(1u << m_options.uFractionBits);
+        h.fScale        = solver.m_config.Scale();
+        m_fInvQuantum   = 1.0f / h.fQuantum;
+        if (std::fwrite(&h, sizeof(h), 1, m_pFile) != 1)
+        {
+            std::fclose(m_pFile);
+            m_pFile = nullptr;
+            return false;
+        }
+
+        m_vBuffers.assign(m_options.uBuffers, Buffer());
+        m_vPrevX.clear();
+        m_vPrevY.clear();
+        m_vGeneration.clear();
+        m_stats        = Stats();
+        m_stats.uBytes = sizeof(h);
+        m_bFailed      = false;
+        m_uHead        = 0;
+        m_uTail        = 0;
+        m_bQuit        = false;
+        m_thread       = std::thread(&TrajectoryWriter::writerMain, this);
+        return true;
+    }
+
+    void TrajectoryWriter::record(const Solver & solver)
+    {
+        if (!m_pFile) return;
+        PROFILE();
+        Buffer * b;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_uHead - m_uTail == m_vBuffers.size())
+            {
+                ++m_stats.uStalls;
+                m_cvFree.wait(lock, [this] { return m_uHead - m_uTail < m_vBuffers.size(); });
+            }
+            b = &m_vBuffers[m_uHead % m_vBuffers.size()];
+        }
+
+        // The writer thread only reads buffers in [tail, head), so this one is ours until queued
+        const ParticleStorage & objects = solver.m_objects;
+        const u32               n       = solver.m_active;
+        b->uFrame                       = solver.m_updates;
+        b->vX.assign(solver.idBound(), NAN);
+        b->vY.assign(solver.idBound(), NAN);
+        b->vGeneration.resize(solver.idBound());
+        for (u32 i = 0; i < n; ++i)
+        {
+            const u32 id       = objects.id(i);
+            b->vX[id]          = objects.Px[i];
+            b->vY[id]          = objects.Py[i];
+            b->vGeneration[id] = objects.generation(id);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_uHead;
+        }
+        m_cvQueued.notify_one();
+    }
+
+    bool TrajectoryWriter::close()
+    {
+        if (!m_pFile) return !m_bFailed;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_bQuit = true;
+        }
+        m_cvQueued.notify_one();
+        m_thread.join();
+
+        m_bFailed |= std::fclose(m_pFile) != 0;
+        m_pFile = nullptr;
+        return !m_bFailed;
+    }
+
+    void TrajectoryWriter::writerMain()
+    {
+        for (;;)
+        {
+            u64 index;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cvQueued.wait(lock, [this] { return m_bQuit || m_uTail != m_uHead; });
+                if (m_uTail == m_uHead) return; // Quit once drained
+                index = m_uTail;
+            }
+
+            encode(m_vBuffers[index % m_vBuffers.size()], index);
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                ++m_uTail;
+            }
+            m_cvFree.notify_one();
+        }
+    }
+
+    void TrajectoryWriter::encode(const Buffer & b, const u64 index)
+    {
+        const u32  n   = static_cast<u32>(b.vX.size());
+        const bool key = index % m_options.uKeyInterval == 0;
+        if (key || m_vPrevX.size() < n)
+        {
+            // Particles new since the last frame start from zero as well
+            m_vPrevX.resize(n, 0);
+            m_vPrevY.resize(n, 0);
+            if (key)
+            {
+                std::fill(m_vPrevX.begin(), m_vPrevX.end(), 0);
+                std::fill(m_vPrevY.begin(), m_vPrevY.end(), 0);
+            }
+        }
+
+        // At most 5 bytes per varint, three per particle
+        m_vEncoded.resize(static_cast<size_t>(n) * 15);
+        u8_t *     out  = m_vEncoded.data();
+        const auto axis = [&](const std::vector<f32> & v, std::vector<i32> & prev)
+        {
+            for (u32 i = 0; i < n; ++i)
+            {
+                // Unsigned, since deltas to and from gaps exceed i32
+                const i32 q     = quantize(v[i], m_fInvQuantum);
+                const u32 delta = static_cast<u32>(q) - static_cast<u32>(prev[i]);
+                out             = putVarint(out, static_cast<i32>(delta));
+                prev[i]         = q;
+            }
+        };
+        axis(b.vX, m_vPrevX);
+        axis(b.vY, m_vPrevY);
+
+        // Gaps keep the generation of the particle before, so an id that is reissued after frames without
+        // a particle is listed too
+        u32 replaced = 0;
+        m_vGeneration.resize(std::max<size_t>(m_vGeneration.size(), n), 0);
+        for (u32 i = 0, last = 0; i < n; ++i)
+        {
+            if (std::isnan(b.vX[i]) || b.vGeneration[i] == m_vGeneration[i]) continue;
+            m_vGeneration[i] = b.vGeneration[i];
+            out              = putVarint(out, static_cast<i32>(i - last));
+            last             = i;
+            ++replaced;
+        }
+
+        FrameHeader h;
+        h.uFrame    = b.uFrame;
+        h.uCount    = n;
+        h.uFlags    = key ? u32(Key) : 0u;
+        h.uBytes    = static_cast<u32>(out - m_vEncoded.data());
+        h.uReplaced = replaced;
+        if (!m_bFailed)
+        {
+            m_bFailed = std::fwrite(&h, sizeof(h), 1, m_pFile) != 1
+                        || std::fwrite(m_vEncoded.data(), 1, h.uBytes, m_pFile) != h.uBytes;
+        }
+
+        // Read by the recording thread only after close() has joined this one
+        ++m_stats.uFrames;
+        m_stats.uRawBytes += sizeof(f32) * 2 * n;
+        m_stats.uBytes += sizeof(h) + h.uBytes;
+    }
+
+    bool TrajectoryReader::open(const char * const path)
+    {
+        close();
+        m_pFile = std::fopen(path, "rb");
+        if (!m_pFile) return false;
+        if (std::fread(&m_header, sizeof(m_header), 1, m_pFile) != 1 || m_header.uMagic != Magic
+            || m_header.uVersion != Version)
+        {
+            close();
+            return false;
+        }
+        m_uStart = std::ftell(m_pFile);
+        m_vPrevX.clear();
+        m_vPrevY.clear();
+        m_vReplaced.clear();
+        m_uFrame = 0;
+        return true;
+    }
+
+    void TrajectoryReader::close()
+    {
+        if (m_pFile) std::fclose(m_pFile);
+        m_pFile = nullptr;
+    }
+
+    bool TrajectoryReader::decode(const u32 count, const bool key, const u32 replaced)
+    {
+        if (key || m_vPrevX.size() < count)
+        {
+            m_vPrevX.resize(count, 0);
+            m_vPrevY.resize(count, 0);
+            if (key)
+            {
+                std::fill(m_vPrevX.begin(), m_vPrevX.end(), 0);
+                std::fill(m_vPrevY.begin(), m_vPrevY.end(), 0);
+            }
+        }
+
+        const u8_t *       in   = m_vEncoded.data();
+        const u8_t * const end  = in + m_vEncoded.size();
+        const auto         axis = [&](std::vector<i32> & prev)
+        {
+            for (u32 i = 0; in && i < count; ++i)
+            {
+                i32 delta = 0;
+                in        = getVarint(in, end, delta);
+                // Unsigned, so damaged input wraps around rather than overflowing
+                prev[i] = static_cast<i32>(static_cast<u32>(prev[i]) + static_cast<u32>(delta));
+            }
+        };
+        axis(m_vPrevX);
+        axis(m_vPrevY);
+
+        m_vReplaced.clear();
+        for (u32 i = 0, id = 0; in && i < replaced; ++i)
+        {
+            i32 delta = 0;
+            in        = getVarint(in, end, delta);
+            id += static_cast<u32>(delta);
+            if (id >= count) return false;
+            m_vReplaced.push_back(id);
+        }
+        return in != nullptr;
+    }
+
+    bool TrajectoryReader::next(std::vector<vec2> & positions)
+    {
+        if (!m_pFile) return false;
+        FrameHeader h;
+        if (std::fread(&h, sizeof(h), 1, m_pFile) != 1 || h.uMagic != FrameMagic) return false;
+        m_vEncoded.resize(h.uBytes);
+        if (std::fread(m_vEncoded.data(), 1, h.uBytes, m_pFile) != h.uBytes) return false;
+        if (!decode(h.uCount, h.uFlags & Key, h.uReplaced)) return false;
+
+        m_uFrame = h.uFrame;
+        positions.resize(h.uCount);
+        for (u32 i = 0; i < h.uCount; ++i)
+        {
+            positions[i] = m_vPrevX[i] == Gap
+                               ? vec2(NAN, NAN)
+                               : vec2(static_cast<f32>(m_vPrevX[i]), static_cast<f32>(m_vPrevY[i]))
+                                     * m_header.fQuantum;
+        }
+        return true;
+    }
+
+    bool TrajectoryReader::seek(const u32 frame)
+    {
+        if (!m_pFile) return false;
+
+        // Find the frame and the last key frame up to it from the frame headers alone
+        long        key = -1, target = -1;
+        FrameHeader h;
+        std::fseek(m_pFile, m_uStart, SEEK_SET);
+        for (long at = m_uStart; std::fread(&h, sizeof(h), 1, m_pFile) == 1 && h.uMagic == FrameMagic;)
+        {
+            if (h.uFlags & Key) key = at;
+            if (h.uFrame >= frame)
+            {
+                target = at;
+                break;
+            }
+            at += static_cast<long>(sizeof(h) + h.uBytes);
+            if (std::fseek(m_pFile, at, SEEK_SET) != 0) break;
+        }
+        if (target < 0 || key < 0) return false;
+
+        // Decode the frames in between without producing positions
+        std::fseek(m_pFile, key, SEEK_SET);
+        while (std::ftell(m_pFile) < target)
+        {
+            if (std::fread(&h, sizeof(h), 1, m_pFile) != 1) return false;
+            m_vEncoded.resize(h.uBytes);
+            if (std::fread(m_vEncoded.data(), 1, h.uBytes, m_pFile) != h.uBytes) return false;
+            if (!decode(h.uCount, h.uFlags & Key, h.uReplaced)) return false;
+            m_uFrame = h.uFrame;
+        }
+        return true;
+    }
+} // namespace PLSC::IO
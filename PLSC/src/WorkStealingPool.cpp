@@ -0,0 +1,138 @@
+#include "PLSC/Parallel/WorkStealingPool.hpp"
+
+namespace PLSC::Parallel
+{
+    namespace
+    {
+        // Pool and queue of the task running on this thread, if any
+        thread_local const WorkStealingPool * t_pool  = nullptr;
+        thread_local u32                      t_queue = 0;
+    } // namespace
+
+    WorkStealingPool::WorkStealingPool(const u32 threads)
+    {
+        const u32 workers = threads > 1 ? threads - 1 : 0;
+        m_queues          = std::make_unique<Queue[]>(workers + 1);
+        m_vThreads.reserve(workers);
+        for (u32 i = 1; i <= workers; ++i) m_vThreads.emplace_back(&WorkStealingPool::workerMain, this, i);
+    }
+
+    WorkStealingPool::~WorkStealingPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_bQuit = true;
+        }
+        m_cv.notify_all();
+        for (std::thread & t : m_vThreads) t.join();
+    }
+
+    void WorkStealingPool::push(Task task)
+    {
+        const u32 self
+            = t_pool == this ? t_queue : m_uNextQueue.fetch_add(1, std::memory_order_relaxed) % size();
+
+        // Counted first, so the counts never drop below the tasks in the queues
+        m_uPending.fetch_add(1, std::memory_order_relaxed);
+        m_uQueued.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(m_queues[self].mutex);
+            m_queues[self].tasks.push_back(std::move(task));
+        }
+
+        // Taking the lock orders this against a thread that just found nothing and is about to sleep
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+        }
+        m_cv.notify_all();
+    }
+
+    bool WorkStealingPool::take(const u32 self, Task & task)
+    {
+        if (!m_uQueued.load(std::memory_order_relaxed)) return false;
+        {
+            Queue &                     own = m_queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty())
+            {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                m_uQueued.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        for (u32 i = 1; i < size(); ++i)
+        {
+            Queue &                     victim = m_queues[(self + i) % size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.tasks.empty()) continue;
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            m_uQueued.fetch_sub(1, std::memory_order_relaxed);
+            m_uSteals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    void WorkStealingPool::run(Task & task)
+    {
+        task();
+        task = nullptr;
+        if (m_uPending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+            }
+            m_cv.notify_all();
+        }
+    }
+
+    void WorkStealingPool::wait()
+    {
+        const WorkStealingPool * const pool  = t_pool;
+        const u32                      queue = t_queue;
+        t_pool                               = this;
+        t_queue                              = 0;
+
+        Task task;
+        for (;;)
+        {
+            if (take(0, task))
+            {
+                run(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock,
+                      [this]
+                      {
+                          return m_uPending.load(std::memory_order_acquire) == 0
+                                 || m_uQueued.load(std::memory_order_relaxed) != 0;
+                      });
+            if (m_uPending.load(std::memory_order_acquire) == 0) break;
+        }
+
+        t_pool  = pool;
+        t_queue = queue;
+    }
+
+    void WorkStealingPool::workerMain(const u32 self)
+    {
+        t_pool  = this;
+        t_queue = self;
+
+        Task task;
+        for (;;)
+        {
+            if (take(self, task))
+            {
+                run(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this] { return m_bQuit || m_uQueued.load(std::memory_order_relaxed) != 0; });
+            if (m_bQuit) return;
+        }
+    }
+} // namespace PLSC::Parallel
@@ -0,0 +1,436 @@
+#include "PLSC.hpp"
+#include "PLSC/DBG/Profile.hpp"
+
+#include <algorithm> // max
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+    #include <unistd.h> // sysconf
+#endif
+
+// Headless benchmark over fixed scenarios. Every scenario starts from the same seed, so runs of
+// the same build are comparable; results go to stdout and, with --json, to a file.
+//
+//   PLSC-Bench [--scenario galton|dense|gas|flow|emit|scaling|pile|all] [--threads n] [--frames n]
+//              [--warmup n] [--sleep] [--skin s] [--reorder n] [--sparse] [--adaptive] [--jacobi]
+//              [--seed n] [--json path] [--trace path]
+//
+// --trace writes the profiled scopes of the whole run as a Chrome trace, see DBG/Profile.hpp.
+
+namespace
+{
+    struct Options
+    {
+        std::string scenario = "all";
+        std::string json;
+        std::string trace;
+        u32         threads  = 1;
+        u32         frames   = 300;
+        u32         warmup   = 100;
+        bool        sleep    = false;
+        double      skin     = 0;
+        u32         reorder  = 0;
+        bool        sparse   = false;
+        bool        adaptive = false;
+        bool        jacobi   = false;
+        u64         seed     = 1;
+    };
+
+    struct Result
+    {
+        std::string name;
+        u32         particles   = 0;
+        u32         frames      = 0;
+        // Phases in ns per particle-substep; 0 without PLSC_PROFILE
+        double      reconstruct = 0;
+        double      collide     = 0;
+        double      integrate   = 0;
+        double      frameMs     = 0;
+        double      throughput  = 0; // Particle-substeps per second
+        double      rssMiB      = 0;
+        double      substeps    = 0; // Per frame
+
+        // Solver::update in ms, from the profiler histograms; 0 without PLSC_PROFILE
+        struct
+        {
+            double p50 = 0, p90 = 0, p99 = 0, p999 = 0, max = 0;
+        } frame;
+    };
+
+    double residentMiB()
+    {
+#ifdef __linux__
+        FILE * f = std::fopen("/proc/self/statm", "r");
+        if (!f) return 0;
+        unsigned long size = 0, resident = 0;
+        const int     read = std::fscanf(f, "%lu %lu", &size, &resident);
+        std::fclose(f);
+        if (read != 2) return 0;
+        const double page = static_cast<double>(sysconf(_SC_PAGESIZE));
+        return static_cast<double>(resident) * page / (1024.0 * 1024.0);
+#else
+        return 0;
+#endif
+    }
+
+    PLSC::SolverConfig mkConfig(const Options & o)
+    {
+        PLSC::SolverConfig config;
+        config.Threads         = o.threads;
+        config.Sleeping        = o.sleep;
+        config.NeighbourSkin   = o.skin;
+        config.ReorderInterval = o.reorder;
+        config.SparseGrid      = o.sparse;
+        config.AdaptiveSubstep = o.adaptive;
+        config.JacobiCollide   = o.jacobi;
+        config.Seed            = o.seed;
+        return config;
+    }
+
+#ifndef PLSC_FIXED_CONFIG
+    // World for n particles at the given area fraction, 16:9
+    void sizeWorld(PLSC::SolverConfig & config, const u32 n, const double fraction)
+    {
+        const double area = static_cast<double>(n) * 0.7854 / fraction; // Solver units, d = 1
+        const double w    = std::sqrt(area * 16.0 / 9.0);
+        config.WorldWidth   = w / config.Scale();
+        config.WorldHeight  = (w * 9.0 / 16.0) / config.Scale();
+        config.MaxInstances = n;
+    }
+#endif
+
+    void addBorder(PLSC::Solver & solver)
+    {
+        (void) solver.m_static.Register(
+            PLSC::Collider::InverseAABB(0, 0, solver.m_config.Width(), solver.m_config.Height()));
+    }
+
+    // Hexagonal packing from the floor up until n particles are placed
+    void fillDense(PLSC::Solver & solver, const u32 n)
+    {
+        const f32 w   = solver.m_config.Width();
+        const f32 h   = solver.m_config.Height();
+        const f32 row = std::sqrt(3.0f) * 0.5f;
+        for (u32 j = 0; solver.m_active < n; ++j)
+        {
+            const f32 y = h - 0.5f - static_cast<f32>(j) * row;
+            if (y < 0.5f) break;
+            for (f32 x = 0.5f + (j & 1 ? 0.5f : 0.0f); x < w - 0.5f && solver.m_active < n; x += 1.0f)
+            {
+                solver.m_objects.store(solver.m_active, PLSC::Particle(x, y));
+                ++solver.m_active;
+            }
+        }
+    }
+
+    Result measure(const char * name, PLSC::Solver & solver, const u32 warmup, const u32 frames,
+                   const bool spawn)
+    {
+        for (u32 i = 0; i < warmup; ++i)
+        {
+            if (spawn) solver.spawnRandom();
+            solver.update();
+        }
+        solver.resetPhaseTimes();
+#if PLSC_PROFILE
+        PLSC::DBG::PROFILE::reset();
+#endif
+
+        using clock   = std::chrono::steady_clock;
+        const auto t0 = clock::now();
+        for (u32 i = 0; i < frames; ++i)
+        {
+            if (spawn) solver.spawnRandom();
+            solver.update();
+        }
+        const double ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+
+        const PLSC::Solver::PhaseTimes t = solver.phaseTimes();
+        const double                   n = static_cast<double>(std::max<u64>(t.uParticleSubsteps, 1));
+
+        Result r;
+        r.name        = name;
+        r.particles   = solver.m_active;
+        r.frames      = frames;
+        r.reconstruct = static_cast<double>(t.uReconstruct) / n;
+        r.collide     = static_cast<double>(t.uCollide) / n;
+        r.integrate   = static_cast<double>(t.uIntegrate) / n;
+        r.frameMs     = ms / static_cast<double>(frames);
+        r.throughput  = n / (ms * 1e-3);
+        r.rssMiB      = residentMiB();
+        r.substeps    = static_cast<double>(t.uSubsteps) / static_cast<double>(std::max<u64>(t.uUpdates, 1));
+#if PLSC_PROFILE
+        PLSC::DBG::PROFILE::percentiles_t p;
+        if (PLSC::DBG::PROFILE::percentiles("update", p))
+        {
+            r.frame.p50  = p.p50;
+            r.frame.p90  = p.p90;
+            r.frame.p99  = p.p99;
+            r.frame.p999 = p.p999;
+            r.frame.max  = p.max;
+        }
+#endif
+        return r;
+    }
+
+    //-- Scenarios
+
+    // examples/galton.cpp without the window: spawn rows into bins until full
+    Result galton(const Options & o)
+    {
+        using namespace PLSC::Constants;
+        const f32 binWidth  = CircleRadius;
+        const f32 binHeight = WorldHeight * 0.3f;
+        const f32 binIncr   = CircleDiameter * 4.0f + binWidth;
+
+        PLSC::Solver solver(mkConfig(o));
+        for (f32 x = binIncr; x + binIncr < WorldWidth; x += binIncr)
+            (void) solver.m_static.Register(
+                PLSC::Collider::AABB(x, WorldHeight - binHeight, x + binWidth, WorldHeight));
+        addBorder(solver);
+        solver.init();
+        return measure("galton", solver, o.warmup, o.frames, true);
+    }
+
+    // Settled hexagonal pile filling most of the box
+    Result dense(const Options & o, const u32 n, const std::string & name, const u32 warmup,
+                 const u32 frames)
+    {
+        PLSC::SolverConfig config = mkConfig(o);
+#ifndef PLSC_FIXED_CONFIG
+        sizeWorld(config, n, 0.7);
+#else
+        (void) n; // The world and capacity are fixed
+#endif
+        PLSC::Solver solver(config);
+        addBorder(solver);
+        solver.init();
+        fillDense(solver, config.MaxInstances);
+        return measure(name.c_str(), solver, warmup, frames, false);
+    }
+
+    // Sparse particles with random velocities and no gravity
+    Result gas(const Options & o)
+    {
+        PLSC::SolverConfig config = mkConfig(o);
+#ifndef PLSC_FIXED_CONFIG
+        sizeWorld(config, 20000, 0.1);
+#endif
+        PLSC::Solver solver(config);
+        solver.m_gravity = PLSC::vec2(0.0f, 0.0f);
+        addBorder(solver);
+        solver.init();
+
+        // One particle per lattice site, jittered without overlap
+        PLSC::Random random(config.Seed, 1);
+        const auto   rnd = [&random]() { return random.uniform(-0.5f, 0.5f); };
+        const f32    w   = solver.m_config.Width(), h = solver.m_config.Height();
+        const f32    s   = std::sqrt(w * h / static_cast<f32>(config.MaxInstances));
+        for (f32 y = s * 0.5f; y < h - s * 0.5f; y += s)
+        {
+            for (f32 x = s * 0.5f; x < w - s * 0.5f && solver.m_active < config.MaxInstances; x += s)
+            {
+                const PLSC::vec2 P(x + rnd() * (s - 1.0f), y + rnd() * (s - 1.0f));
+                const PLSC::vec2 v(rnd() * 0.1f, rnd() * 0.1f);
+                solver.m_objects.store(solver.m_active, PLSC::Particle(P, P - v));
+                ++solver.m_active;
+            }
+        }
+        return measure("gas", solver, o.warmup, o.frames, false);
+    }
+
+    // Rows spawned every frame fall into a sink along the floor, so the particle count levels off
+    Result flow(const Options & o)
+    {
+        PLSC::Solver solver(mkConfig(o));
+        const f32    w = solver.m_config.Width(), h = solver.m_config.Height();
+        (void) solver.m_sinks.Register(PLSC::Collider::AABB(0, h - 4.0f, w, h));
+        addBorder(solver);
+        solver.init();
+        return measure("flow", solver, o.warmup, o.frames, true);
+    }
+
+    // flow fed by a line emitter along the top instead of spawnRandom rows, as many particles per frame
+    // but none placed onto another, compare the p99 and max frame times
+    Result emit(const Options & o)
+    {
+        PLSC::Solver solver(mkConfig(o));
+        const f32    w = solver.m_config.Width(), h = solver.m_config.Height();
+        (void) solver.m_sinks.Register(PLSC::Collider::AABB(0, h - 4.0f, w, h));
+        addBorder(solver);
+        solver.init();
+
+        PLSC::Emitter e;
+        e.uShape  = PLSC::Emitter::Line;
+        e.A       = PLSC::vec2(1.0f, 1.0f);
+        e.B       = PLSC::vec2(w - 1.0f, 1.0f);
+        e.fRate   = static_cast<f32>(solver.m_config.CirclesPerWidth());
+        e.fSpread = 2.0f;
+        solver.m_emitters.push_back(e);
+        return measure("emit", solver, o.warmup, o.frames, false);
+    }
+
+    // Dense pile in the corner of a world a hundred times its size, where the grid over the whole
+    // world costs more than the particles. Compare with --sparse.
+    Result pile(const Options & o)
+    {
+        PLSC::SolverConfig config = mkConfig(o);
+#ifndef PLSC_FIXED_CONFIG
+        sizeWorld(config, 2000000, 0.7);
+        config.MaxInstances = 20000;
+#endif
+        PLSC::Solver solver(config);
+        addBorder(solver);
+        solver.init();
+
+        const u32 n   = config.MaxInstances;
+        const f32 w   = std::sqrt(static_cast<f32>(n) * 16.0f / 9.0f);
+        const f32 h   = solver.m_config.Height();
+        const f32 row = std::sqrt(3.0f) * 0.5f;
+        for (u32 j = 0; solver.m_active < n; ++j)
+        {
+            const f32 y = h - 0.5f - static_cast<f32>(j) * row;
+            for (f32 x = 0.5f + (j & 1 ? 0.5f : 0.0f); x < w && solver.m_active < n; x += 1.0f)
+            {
+                solver.m_objects.store(solver.m_active, PLSC::Particle(x, y));
+                ++solver.m_active;
+            }
+        }
+        return measure("pile", solver, o.warmup, o.frames, false);
+    }
+
+    void print(const Result & r)
+    {
+        const double total = r.reconstruct + r.collide + r.integrate;
+        std::printf("%-14s %9u %7.2f %7.2f %7.2f %7.2f %9.2f %8.2f %8.2f %8.1f %8.1f %8.1f\n", r.name.c_str(),
+                    r.particles, r.reconstruct, r.collide, r.integrate, total, r.frameMs, r.frame.p99,
+                    r.frame.max, r.throughput * 1e-6, r.rssMiB, r.substeps);
+    }
+
+    bool writeJson(const std::string & path, const Options & o, const std::vector<Result> & results)
+    {
+        FILE * f = std::fopen(path.c_str(), "w");
+        if (!f) return false;
+        std::fprintf(f, "{\n  \"threads\": %u,\n  \"sleep\": %s,\n  \"skin\": %g,\n", o.threads,
+                     o.sleep ? "true" : "false", o.skin);
+        std::fprintf(f, "  \"reorder\": %u,\n  \"sparse\": %s,\n  \"adaptive\": %s,\n  \"jacobi\": %s,\n",
+                     o.reorder, o.sparse ? "true" : "false", o.adaptive ? "true" : "false",
+                     o.jacobi ? "true" : "false");
+        std::fprintf(f, "  \"warmup\": %u,\n  \"scenarios\": [\n", o.warmup);
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const Result & r = results[i];
+            std::fprintf(f,
+                         "    {\"name\": \"%s\", \"particles\": %u, \"frames\": %u, "
+                         "\"ns_per_particle_substep\": {\"reconstruct\": %.3f, \"collide\": %.3f, "
+                         "\"integrate\": %.3f, \"total\": %.3f}, \"ms_per_frame\": %.4f, "
+                         "\"frame_ms\": {\"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"p99.9\": %.4f, "
+                         "\"max\": %.4f}, \"particle_substeps_per_s\": %.0f, \"rss_mib\": %.1f, "
+                         "\"substeps_per_frame\": %.2f}%s\n",
+                         r.name.c_str(), r.particles, r.frames, r.reconstruct, r.collide, r.integrate,
+                         r.reconstruct + r.collide + r.integrate, r.frameMs, r.frame.p50, r.frame.p90,
+                         r.frame.p99, r.frame.p999, r.frame.max, r.throughput, r.rssMiB, r.substeps,
+                         i + 1 < results.size() ? "," : "");
+        }
+        std::fprintf(f, "  ]\n}\n");
+        std::fclose(f);
+        return true;
+    }
+} // namespace
+
+int main(int argc, char ** argv)
+{
+    Options o;
+    for (int i = 1; i < argc; ++i)
+    {
+        const bool        more = i + 1 < argc;
+        const std::string a    = argv[i];
+        if (a == "--scenario" && more) o.scenario = argv[++i];
+        else if (a == "--json" && more)
+            o.json = argv[++i];
+        else if (a == "--trace" && more)
+            o.trace = argv[++i];
+        else if (a == "--threads" && more)
+            o.threads = static_cast<u32>(std::atoi(argv[++i]));
+        else if (a == "--frames" && more)
+            o.frames = static_cast<u32>(std::atoi(argv[++i]));
+        else if (a == "--warmup" && more)
+            o.warmup = static_cast<u32>(std::atoi(argv[++i]));
+        else if (a == "--skin" && more)
+            o.skin = std::atof(argv[++i]);
+        else if (a == "--reorder" && more)
+            o.reorder = static_cast<u32>(std::atoi(argv[++i]));
+        else if (a == "--seed" && more)
+            o.seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (a == "--sleep")
+            o.sleep = true;
+        else if (a == "--sparse")
+            o.sparse = true;
+        else if (a == "--adaptive")
+            o.adaptive = true;
+        else if (a == "--jacobi")
+            o.jacobi = true;
+        else
+        {
+            std::fprintf(stderr, "Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    std::vector<Result> results;
+    const auto          add = [&](const Result & r)
+    {
+        print(r);
+        std::fflush(stdout);
+        results.push_back(r);
+    };
+    const auto run = [&](const char * name) { return o.scenario == "all" || o.scenario == name; };
+
+#if PLSC_PROFILE
+    if (!o.trace.empty()) PLSC::DBG::PROFILE::traceStart();
+#else
+    if (!o.trace.empty()) std::fprintf(stderr, "Built without PLSC_PROFILE, --trace is ignored\n");
+#endif
+
+    std::printf("%-14s %9s %7s %7s %7s %7s %9s %8s %8s %8s %8s %8s\n", "scenario", "particles", "recon",
+                "collide", "integr", "total", "ms/frame", "p99 ms", "max ms", "M ps/s", "RSS MiB",
+                "substeps");
+    if (run("galton")) add(galton(o));
+    if (run("dense")) add(dense(o, 40000, "dense", o.warmup, o.frames));
+    if (run("gas")) add(gas(o));
+    if (run("flow")) add(flow(o));
+    if (run("emit")) add(emit(o));
+    if (run("pile")) add(pile(o));
+#ifndef PLSC_FIXED_CONFIG
+    // Dense packing from 10k to 640k particles, fewer frames as they grow
+    if (run("scaling"))
+    {
+        for (u32 n = 10000; n <= 640000; n *= 4)
+        {
+            const u32 scale = n / 10000;
+            add(dense(o, n, "scaling-" + std::to_string(n / 1000) + "k", std::max<u32>(5, o.warmup / scale),
+                      std::max<u32>(10, o.frames / scale)));
+        }
+    }
+#endif
+
+#if PLSC_PROFILE
+    if (!o.trace.empty() && !PLSC::DBG::PROFILE::traceWrite(o.trace.c_str()))
+    {
+        std::fprintf(stderr, "Could not write %s\n", o.trace.c_str());
+        return 1;
+    }
+#endif
+    if (!o.json.empty() && !writeJson(o.json, o, results))
+    {
+        std::fprintf(stderr, "Could not write %s\n", o.json.c_str());
+        return 1;
+    }
+    return 0;
+}
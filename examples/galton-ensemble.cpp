@@ -0,0 +1,96 @@
+#include "PLSC.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+static constexpr f64 BinSize   = PLSC::Constants::CircleDiameter * 4.0f;
+static constexpr f64 BinWidth  = PLSC::Constants::CircleRadius;
+static constexpr f64 BinHeight = PLSC::Constants::WorldHeight * 0.3f;
+
+static constexpr f64    BinIncr = BinSize + BinWidth;
+static constexpr size_t NBins
+    = static_cast<size_t>((PLSC::Constants::HIGHP::WorldWidth - (BinIncr)) / BinIncr);
+
+static PLSC::Collider::AABB MkBins(size_t i)
+{
+    f32 cx = BinIncr + (BinIncr * static_cast<f32>(i));
+    f32 x0 = cx;
+    f32 x1 = cx + BinWidth;
+    f32 y0 = PLSC::Constants::WorldHeight - BinHeight;
+    f32 y1 = PLSC::Constants::WorldHeight;
+    return PLSC::Collider::AABB(x0, y0, x1, y1);
+}
+
+// Many Galton boards on different seeds, each filled and left to settle, summed into one histogram
+// of the particles per bin.
+//
+//   PLSC-GaltonEnsemble [boards] [threads] [frames per board] [seed]
+int main(int argc, char ** argv)
+{
+    const u32 boards  = argc > 1 ? static_cast<u32>(std::atoi(argv[1])) : 64;
+    const u32 threads = argc > 2 ? static_cast<u32>(std::atoi(argv[2])) : std::thread::hardware_concurrency();
+    const u32 frames  = argc > 3 ? static_cast<u32>(std::atoi(argv[3])) : 1000;
+
+    PLSC::SolverConfig config;
+    config.NeighbourSkin = 0.3;
+    if (argc > 4) config.Seed = std::strtoull(argv[4], nullptr, 10);
+
+    PLSC::Ensemble ensemble(config, std::max(threads, 1u));
+
+    const auto setup = [](PLSC::Solver & solver, u32)
+    {
+        (void) solver.m_static.Register(MkBins, NBins);
+        (void) solver.m_static.Register(
+            PLSC::Collider::InverseAABB(0, 0, PLSC::Constants::WorldWidth, PLSC::Constants::WorldHeight));
+    };
+    const auto step = [](PLSC::Solver & solver, u32)
+    {
+        solver.spawnRandom();
+        return true;
+    };
+    // Particles resting between two bin walls, by bin
+    const auto collect = [](const PLSC::Solver & solver, u32)
+    {
+        std::vector<u32> bins(NBins + 1, 0);
+        const f32        top = PLSC::Constants::WorldHeight - BinHeight;
+        for (u32 i = 0; i < solver.m_active; ++i)
+        {
+            if (solver.m_objects.Py[i] < top) continue;
+            const f32 x = std::floor(solver.m_objects.Px[i] / static_cast<f32>(BinIncr));
+            ++bins[static_cast<size_t>(std::clamp(x, 0.0f, static_cast<f32>(NBins)))];
+        }
+        return bins;
+    };
+
+    using clock        = std::chrono::steady_clock;
+    const auto t0      = clock::now();
+    const auto results = ensemble.run<std::vector<u32>>(boards, frames, setup, step, collect);
+    const f64  seconds = std::chrono::duration<f64>(clock::now() - t0).count();
+
+    std::vector<u64> total(NBins + 1, 0);
+    u64              particles = 0;
+    for (const std::vector<u32> & h : results)
+    {
+        for (size_t i = 0; i < h.size(); ++i) total[i] += h[i];
+        for (const u32 n : h) particles += n;
+    }
+
+    const u64 most = std::max<u64>(*std::max_element(total.begin(), total.end()), 1);
+    for (size_t i = 0; i < total.size(); ++i)
+    {
+        const int bar = static_cast<int>(60 * total[i] / most);
+        std::printf("%3zu %9llu %.*s\n", i, static_cast<unsigned long long>(total[i]), bar,
+                    "############################################################");
+    }
+
+    const PLSC::Ensemble::Stats & stats = ensemble.stats();
+    std::printf("%u boards, %llu particles binned, %u threads: %.2f s, %.2f boards/s, %llu steals\n", boards,
+                static_cast<unsigned long long>(particles), ensemble.threads(), seconds,
+                static_cast<f64>(boards) / seconds, static_cast<unsigned long long>(stats.uSteals));
+    return 0;
+}
@@ -1,5 +1,9 @@
 #include "PLSC.hpp"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
 static constexpr f64 BinSize   = PLSC::Constants::CircleDiameter * 4.0f;
 static constexpr f64 BinWidth  = PLSC::Constants::CircleRadius;
 static constexpr f64 BinHeight = PLSC::Constants::WorldHeight * 0.3f;
@@ -18,23 +22,35 @@ static PLSC::Collider::AABB MkBins(size_t i)
     return PLSC::Collider::AABB(x0, y0, x1, y1);
 }
 
+// PLSC-GaltonHeadless [threads] [trajectory file] [frames per recorded frame]
 int main(int argc, char ** argv)
 {
-    (void) argc;
-    (void) argv;
+    PLSC::SolverConfig config;
+    if (argc > 1) config.Threads = static_cast<u32>(std::atoi(argv[1]));
+    const char * trajectory = argc > 2 ? argv[2] : nullptr;
+    const int    every      = argc > 3 ? std::max(std::atoi(argv[3]), 1) : 10;
 
-    PLSC::Solver solver;
+    PLSC::Solver solver(config);
 
     (void) solver.m_static.Register(MkBins, NBins);
     (void) solver.m_static.Register(
         PLSC::Collider::InverseAABB(0, 0, PLSC::Constants::WorldWidth, PLSC::Constants::WorldHeight));
 
     solver.init();
+
+    PLSC::IO::TrajectoryWriter recorder;
+    if (trajectory && !recorder.open(trajectory, solver))
+    {
+        std::fprintf(stderr, "Cannot write %s\n", trajectory);
+        return 1;
+    }
+
     bool flipGravity = false;
     for (int i = 0; i < 5000; ++i)
     {
         solver.spawnRandom();
         solver.update();
+        if (i % every == 0) recorder.record(solver);
 
         f32 KE    = solver.getKE();
         f32 KEavg = (KE / (f32) solver.m_active) * 1000.0f;
@@ -51,5 +67,17 @@ int main(int argc, char ** argv)
             flipGravity = false;
     }
 
+    if (trajectory)
+    {
+        if (!recorder.close())
+        {
+            std::fprintf(stderr, "Cannot write %s\n", trajectory);
+            return 1;
+        }
+        const PLSC::IO::TrajectoryWriter::Stats & stats = recorder.stats();
+        std::printf("%llu frames, %.1f MB of %.1f MB raw, %llu stalls\n", stats.uFrames,
+                    static_cast<f64>(stats.uBytes) / 1e6, static_cast<f64>(stats.uRawBytes) / 1e6,
+                    stats.uStalls);
+    }
     return 0;
 }
\ No newline at end of file
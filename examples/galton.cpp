@@ -33,7 +33,7 @@ int main(int argc, char ** argv)
     PLSC::Demo::Window          window(1280, 720, 50, 50, false);
     PLSC::Solver                solver;
     PLSC::GL::Renderer          staticRenderer;
-    PLSC::GL::ParticleInstancer particleRenderer(&solver.m_objects[0]);
+    PLSC::GL::ParticleInstancer particleRenderer(&solver.m_objects);
 
     auto bins = solver.m_static.Register(MkBins, NBins);
     staticRenderer.Register(bins);